@@ -21,6 +21,10 @@ void storeLabel(unsigned src, const char *label);
 // store value of src into addr
 void storeAddr(unsigned src, unsigned addr);
 
+// print the block counters of a program built with -lc3-instrument, does
+// nothing otherwise
+void dumpLC3Counters(void);
+
 #ifdef DEBUG
 
 void printInt(unsigned x) {
@@ -0,0 +1,396 @@
+#include "LC3Assembler.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/Format.h"
+
+using namespace llvm;
+
+// Returns true if Op, in upper case, is an instruction or a directive. Any
+// other first word of a line is a label.
+static bool isMnemonic(StringRef Op) {
+  if (Op.startswith("BR") &&
+      Op.drop_front(2).find_first_not_of("NZP") == StringRef::npos) {
+    return true;
+  }
+  return StringSwitch<bool>(Op)
+      .Cases("ADD", "AND", "NOT", "JMP", "JSR", "JSRR", "LD", "LDI", true)
+      .Cases("LDR", "LEA", "ST", "STI", "STR", "TRAP", "RET", "RTI", true)
+      .Cases("GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT", true)
+      .Cases(".ORIG", ".FILL", ".BLKW", ".STRINGZ", ".END", true)
+      .Default(false);
+}
+
+// Splits the raw line Line into its label and its instruction, left empty
+// when there is none.
+static void splitRaw(StringRef Line, std::string &Label, LC3MachineInst &MI) {
+  bool InString = false;
+  for (size_t Pos = 0; Pos < Line.size(); Pos++) {
+    if (Line[Pos] == '"' && (!Pos || Line[Pos - 1] != '\\')) {
+      InString = !InString;
+    } else if (Line[Pos] == ';' && !InString) {
+      Line = Line.take_front(Pos);
+      break;
+    }
+  }
+  StringRef Text = Line.trim();
+  StringRef Word = Text.take_until([](char C) { return isSpace(C); });
+  if (!Word.empty() && !isMnemonic(Word.upper())) {
+    Label = Word.str();
+    Text = Text.drop_front(Word.size()).ltrim();
+  }
+  if (Text.empty()) {
+    return;
+  }
+  Word = Text.take_until([](char C) { return isSpace(C); });
+  Text = Text.drop_front(Word.size()).trim();
+  MI = {LC3MachineInst::Inst, Word.upper(), "", {}, ""};
+  if (StringRef(MI.Op).startswith("BR")) {
+    MI.CondCodes = StringRef(MI.Op).drop_front(2).lower();
+    MI.Op = "BR";
+  }
+  if (MI.Op == ".STRINGZ") {
+    MI.Operands.push_back(Text.str());
+    return;
+  }
+  SmallVector<StringRef, 3> Operands;
+  SplitString(Text, Operands, ", \t");
+  for (StringRef Operand : Operands) {
+    MI.Operands.push_back(Operand.str());
+  }
+}
+
+// Parses the number Operand, written #12, x3000 or 12.
+static bool parseNumber(StringRef Operand, int64_t &Val) {
+  if (Operand.consume_front("x") || Operand.consume_front("X")) {
+    bool Negative = Operand.consume_front("-");
+    if (Operand.empty() || Operand.getAsInteger(16, Val)) {
+      return false;
+    }
+    Val = Negative ? -Val : Val;
+    return true;
+  }
+  Operand.consume_front("#");
+  return !Operand.empty() && !Operand.getAsInteger(10, Val);
+}
+
+// Returns the characters of the quoted string Operand, false if it is not
+// one.
+static bool parseString(StringRef Operand, std::string &Str) {
+  if (Operand.size() < 2 || Operand.front() != '"' || Operand.back() != '"') {
+    return false;
+  }
+  Operand = Operand.drop_front().drop_back();
+  for (size_t Pos = 0; Pos < Operand.size(); Pos++) {
+    char C = Operand[Pos];
+    if (C == '\\' && Pos + 1 < Operand.size()) {
+      switch (C = Operand[++Pos]) {
+      case 'n':
+        C = '\n';
+        break;
+      case 't':
+        C = '\t';
+        break;
+      case 'r':
+        C = '\r';
+        break;
+      case '0':
+        C = '\0';
+        break;
+      }
+    }
+    Str += C;
+  }
+  return true;
+}
+
+// Returns the instruction as written in the .asm file, for the errors.
+static std::string getText(const LC3MachineInst &MI) {
+  return MI.Op + MI.CondCodes + " " + join(MI.Operands, ", ");
+}
+
+bool LC3Assembler::assemble(ArrayRef<LC3MachineInst> Insts,
+                            StringRef FileName) {
+  this->FileName = FileName.str();
+  for (size_t Index = 0; Index < Insts.size(); Index++) {
+    if (!addStatements(Insts[Index], Index + 1)) {
+      break;
+    }
+  }
+  if (!defineLabels()) {
+    return false;
+  }
+  for (auto &S : Statements) {
+    if (S.MI.Kind == LC3MachineInst::Inst && S.MI.Op != ".ORIG") {
+      encode(S, Origin + Words.size());
+      WordLines.resize(Words.size(), S.Line);
+    }
+  }
+  return !NumErrors;
+}
+
+// Adds the label and the instruction of MI, returns false after .END.
+bool LC3Assembler::addStatements(const LC3MachineInst &MI, int Line) {
+  LC3Statement S = {"", {LC3MachineInst::Blank}, Line};
+  switch (MI.Kind) {
+  case LC3MachineInst::Inst:
+    S.MI = MI;
+    break;
+  case LC3MachineInst::Label:
+  case LC3MachineInst::Raw:
+    splitRaw(MI.Text, S.Label, S.MI);
+    break;
+  default:
+    return true;
+  }
+  if (!S.Label.empty()) {
+    Statements.push_back({S.Label, {LC3MachineInst::Blank}, Line});
+  }
+  if (S.MI.Kind == LC3MachineInst::Inst) {
+    if (S.MI.Op == ".END") {
+      return false;
+    }
+    Statements.push_back({"", std::move(S.MI), Line});
+  }
+  return true;
+}
+
+// Gives the labels their addresses.
+bool LC3Assembler::defineLabels() {
+  int Addr = -1;
+  for (auto &S : Statements) {
+    if (!S.Label.empty()) {
+      if (Addr < 0) {
+        error(S, "label " + S.Label + " before .ORIG");
+      } else if (!SymbolMap.insert({S.Label, Addr}).second) {
+        error(S, "label " + S.Label + " defined twice");
+      } else {
+        Symbols.push_back({S.Label, Addr});
+      }
+      continue;
+    }
+    if (S.MI.Op == ".ORIG") {
+      int64_t Val;
+      if (Origin >= 0) {
+        error(S, "only one .ORIG is supported");
+      } else if (S.MI.Operands.size() != 1 ||
+                 !parseNumber(S.MI.Operands[0], Val) || Val < 0 ||
+                 Val > 0xFFFF) {
+        error(S, "invalid .ORIG");
+      } else {
+        Origin = Addr = Val;
+      }
+      continue;
+    }
+    if (Addr < 0) {
+      error(S, "instruction before .ORIG");
+      return false;
+    }
+    int64_t Words = 1;
+    std::string Str;
+    if (S.MI.Op == ".BLKW") {
+      if (S.MI.Operands.size() != 1 ||
+          !parseNumber(S.MI.Operands[0], Words) || Words < 0) {
+        error(S, "invalid .BLKW");
+        Words = 0;
+      }
+    } else if (S.MI.Op == ".STRINGZ") {
+      if (S.MI.Operands.size() != 1 || !parseString(S.MI.Operands[0], Str)) {
+        error(S, "invalid .STRINGZ");
+      }
+      Words = Str.size() + 1;
+    }
+    Addr += Words;
+    if (Addr > 0x10000) {
+      error(S, "program past the end of the memory");
+      return false;
+    }
+  }
+  if (Origin < 0) {
+    errs() << "Error: " << FileName << ": no .ORIG\n";
+    return false;
+  }
+  return !NumErrors;
+}
+
+bool LC3Assembler::getValue(const LC3Statement &S, StringRef Operand,
+                            int64_t &Val) {
+  if (parseNumber(Operand, Val)) {
+    return true;
+  }
+  if (auto It = SymbolMap.find(Operand); It != SymbolMap.end()) {
+    Val = It->second;
+    return true;
+  }
+  error(S, "unknown label " + Operand + " in " + getText(S.MI));
+  return false;
+}
+
+bool LC3Assembler::getRegOperand(const LC3Statement &S, unsigned Index,
+                                 unsigned &Reg) {
+  int Val = LC3MachineInst::getReg(S.MI.Operands[Index]);
+  if (Val < 0) {
+    error(S, "expected a register in " + getText(S.MI));
+    return false;
+  }
+  Reg = Val;
+  return true;
+}
+
+// Returns the field of Bits bits for the operand Index, a PC offset from
+// Addr if IsPC, an immediate otherwise.
+bool LC3Assembler::getField(const LC3Statement &S, unsigned Index, int Bits,
+                            bool IsPC, int Addr, unsigned &Field) {
+  StringRef Operand = S.MI.Operands[Index];
+  int64_t Val;
+  bool IsLabel = !parseNumber(Operand, Val);
+  if (!getValue(S, Operand, Val)) {
+    return false;
+  }
+  if (IsPC && IsLabel) {
+    Val -= Addr + 1;
+  }
+  int64_t Min = -(1 << (Bits - 1));
+  int64_t Max = (1 << (Bits - 1)) - 1;
+  if (Val < Min || Val > Max) {
+    error(S, Twine(IsPC ? "PC offset " : "immediate ") + Twine(Val) +
+                 " out of range [" + Twine(Min) + ", " + Twine(Max) +
+                 "] in " + getText(S.MI));
+    return false;
+  }
+  Field = Val & ((1 << Bits) - 1);
+  return true;
+}
+
+void LC3Assembler::encode(const LC3Statement &S, int Addr) {
+  const LC3MachineInst &MI = S.MI;
+  StringRef Op = MI.Op;
+  if (Op == ".BLKW") {
+    int64_t Count = 0;
+    parseNumber(MI.Operands[0], Count);
+    Words.resize(Words.size() + Count);
+    return;
+  }
+  if (Op == ".STRINGZ") {
+    std::string Str;
+    parseString(MI.Operands[0], Str);
+    for (char C : Str) {
+      Words.push_back((unsigned char)C);
+    }
+    Words.push_back(0);
+    return;
+  }
+
+  unsigned NumOperands =
+      StringSwitch<unsigned>(Op)
+          .Cases("ADD", "AND", "LDR", "STR", 3)
+          .Cases("NOT", "LD", "LDI", "LEA", "ST", "STI", 2)
+          .Cases("BR", "JMP", "JSR", "JSRR", "TRAP", ".FILL", 1)
+          .Default(0);
+  // Words of the instructions taking no operand, 0 for unknown ones.
+  uint16_t Word = StringSwitch<uint16_t>(Op)
+                      .Case("RET", 0xC1C0)
+                      .Case("RTI", 0x8000)
+                      .Case("GETC", 0xF020)
+                      .Case("OUT", 0xF021)
+                      .Case("PUTS", 0xF022)
+                      .Case("IN", 0xF023)
+                      .Case("PUTSP", 0xF024)
+                      .Case("HALT", 0xF025)
+                      .Default(0);
+  if (!NumOperands && !Word) {
+    error(S, "unknown instruction " + getText(MI));
+    Words.push_back(0);
+    return;
+  }
+  if (MI.Operands.size() != NumOperands) {
+    error(S, "expected " + Twine(NumOperands) + " operands in " +
+                 getText(MI));
+    Words.push_back(0);
+    return;
+  }
+
+  unsigned DR = 0, SR = 0, Field = 0;
+  bool Valid = true;
+  if (Op == "ADD" || Op == "AND") {
+    Word = Op == "ADD" ? 0x1000 : 0x5000;
+    Valid = getRegOperand(S, 0, DR) && getRegOperand(S, 1, SR);
+    if (LC3MachineInst::getReg(MI.Operands[2]) >= 0) {
+      Field = LC3MachineInst::getReg(MI.Operands[2]);
+    } else if (getField(S, 2, 5, false, Addr, Field)) {
+      Field |= 0x20;
+    } else {
+      Valid = false;
+    }
+    Word |= DR << 9 | SR << 6 | Field;
+  } else if (Op == "NOT") {
+    Valid = getRegOperand(S, 0, DR) && getRegOperand(S, 1, SR);
+    Word = 0x9000 | DR << 9 | SR << 6 | 0x3F;
+  } else if (Op == "BR") {
+    StringRef CondCodes = MI.CondCodes.empty() ? "nzp" : MI.CondCodes;
+    Word = (CondCodes.contains('n') ? 0x800 : 0) |
+           (CondCodes.contains('z') ? 0x400 : 0) |
+           (CondCodes.contains('p') ? 0x200 : 0);
+    Valid = getField(S, 0, 9, true, Addr, Field);
+    Word |= Field;
+  } else if (Op == "JMP" || Op == "JSRR") {
+    Valid = getRegOperand(S, 0, SR);
+    Word = (Op == "JMP" ? 0xC000 : 0x4000) | SR << 6;
+  } else if (Op == "JSR") {
+    Valid = getField(S, 0, 11, true, Addr, Field);
+    Word = 0x4800 | Field;
+  } else if (Op == "LDR" || Op == "STR") {
+    Valid = getRegOperand(S, 0, DR) && getRegOperand(S, 1, SR) &&
+            getField(S, 2, 6, false, Addr, Field);
+    Word = (Op == "LDR" ? 0x6000 : 0x7000) | DR << 9 | SR << 6 | Field;
+  } else if (Op == "TRAP") {
+    int64_t Vector = 0;
+    Valid = getValue(S, MI.Operands[0], Vector);
+    if (Valid && (Vector < 0 || Vector > 0xFF)) {
+      error(S, "trap vector out of range in " + getText(MI));
+      Valid = false;
+    }
+    Word = 0xF000 | (Vector & 0xFF);
+  } else if (Op == ".FILL") {
+    int64_t Val = 0;
+    Valid = getValue(S, MI.Operands[0], Val);
+    if (Valid && (Val < -0x8000 || Val > 0xFFFF)) {
+      error(S, "value out of range in " + getText(MI));
+      Valid = false;
+    }
+    Word = Val & 0xFFFF;
+  } else if (NumOperands == 2) {
+    Word = StringSwitch<uint16_t>(Op)
+               .Case("LD", 0x2000)
+               .Case("LDI", 0xA000)
+               .Case("LEA", 0xE000)
+               .Case("ST", 0x3000)
+               .Default(0xB000);
+    Valid = getRegOperand(S, 0, DR) && getField(S, 1, 9, true, Addr, Field);
+    Word |= DR << 9 | Field;
+  }
+  Words.push_back(Valid ? Word : 0);
+}
+
+void LC3Assembler::error(const LC3Statement &S, const Twine &Message) {
+  errs() << "Error: " << FileName << ":" << S.Line << ": " << Message << "\n";
+  NumErrors++;
+}
+
+void LC3Assembler::writeObject(raw_ostream &OS) const {
+  OS << char(Origin >> 8) << char(Origin);
+  for (uint16_t Word : Words) {
+    OS << char(Word >> 8) << char(Word);
+  }
+}
+
+void LC3Assembler::writeSymbols(raw_ostream &OS) const {
+  OS << "// Symbol table\n"
+     << "// Scope level 0:\n"
+     << "//\tSymbol Name       Page Address\n"
+     << "//\t----------------  ------------\n";
+  for (auto &Symbol : Symbols) {
+    OS << "//\t" << format("%-16s  %04X", Symbol.first.c_str(), Symbol.second)
+       << "\n";
+  }
+  OS << "\n";
+}
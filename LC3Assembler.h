@@ -0,0 +1,74 @@
+#ifndef LC3ASSEMBLER_H
+#define LC3ASSEMBLER_H
+
+#include "LC3MachineInst.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// Assembler turning the code of the whole program into the object image and
+// the symbol table lc3as writes for it.
+//
+// Labels are given their addresses in a first pass over the code, the
+// instructions are encoded in a second one. Raw lines, which come from the
+// assembly integrated by the program, are split into their label and their
+// instruction first. Every immediate and PC offset out of the reach of its
+// field is reported with the line it is on, numbered as in the .asm file.
+class LC3Assembler {
+public:
+  // Assembles Insts, the lines of FileName. Returns false after reporting
+  // the errors found.
+  bool assemble(ArrayRef<LC3MachineInst> Insts, StringRef FileName);
+
+  // Writes the origin then the words of the program, big endian.
+  void writeObject(raw_ostream &OS) const;
+  // Writes the labels and their addresses, in the format of lc3as.
+  void writeSymbols(raw_ostream &OS) const;
+
+  int getOrigin() const { return Origin; }
+  ArrayRef<uint16_t> getWords() const { return Words; }
+  // Returns the labels and their addresses, in the order of the program.
+  ArrayRef<std::pair<std::string, int>> getSymbols() const {
+    return Symbols;
+  }
+  // Returns the number of the line each word comes from.
+  ArrayRef<int> getWordLines() const { return WordLines; }
+  int getNumWords() const { return Words.size(); }
+
+private:
+  // A label or an instruction of the program, with the number of the line
+  // it comes from.
+  struct LC3Statement {
+    std::string Label;
+    LC3MachineInst MI;
+    int Line;
+  };
+
+  bool addStatements(const LC3MachineInst &MI, int Line);
+  bool defineLabels();
+  void encode(const LC3Statement &S, int Addr);
+  bool getValue(const LC3Statement &S, StringRef Operand, int64_t &Val);
+  bool getRegOperand(const LC3Statement &S, unsigned Index, unsigned &Reg);
+  bool getField(const LC3Statement &S, unsigned Index, int Bits, bool IsPC,
+                int Addr, unsigned &Field);
+  void error(const LC3Statement &S, const Twine &Message);
+
+  std::string FileName;
+  std::vector<LC3Statement> Statements;
+  std::vector<std::pair<std::string, int>> Symbols;
+  StringMap<int> SymbolMap;
+  int Origin = -1;
+  std::vector<uint16_t> Words;
+  std::vector<int> WordLines;
+  int NumErrors = 0;
+};
+
+} // namespace llvm
+
+#endif // LC3ASSEMBLER_H
@@ -0,0 +1,233 @@
+#include "LC3ConstantPool.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace llvm;
+
+// References are written as the entry number between two RefMarks.
+static constexpr char RefMark = '\x01';
+
+// PC offset range of LD, LEA and STI.
+static constexpr int MinOffset = -256;
+static constexpr int MaxOffset = 255;
+
+std::string LC3ConstantPool::addEntry(StringRef Op, const std::string &Operand,
+                                      int Words) {
+  auto Inserted = EntryMap.insert({(Op + " " + Operand).str(), Entries.size()});
+  unsigned ID = Inserted.first->second;
+  if (Inserted.second) {
+    Entries.push_back(
+        {{LC3MachineInst::Inst, Op.str(), "", {Operand}, ""}, Words});
+  }
+  if (BlockEntries.insert(ID).second) {
+    BlockPoolWords += Words;
+  }
+  return RefMark + std::to_string(ID) + RefMark;
+}
+
+std::string LC3ConstantPool::addFill(int64_t Val) {
+  return addEntry(".FILL", "#" + std::to_string(Val), 1);
+}
+
+std::string LC3ConstantPool::addAddress(StringRef Label) {
+  return addEntry(".FILL", Label.str(), 1);
+}
+
+std::string LC3ConstantPool::addString(StringRef Str) {
+  return addEntry(".STRINGZ", "\"" + Str.str() + "\"", Str.size() + 1);
+}
+
+void LC3ConstantPool::layout(
+    LC3Code &Code, LC3Code &Out, bool NoComment,
+    function_ref<uint64_t(const LC3MachineInst &)> Frequency) {
+  struct LC3Line {
+    // Offset of the first word of the line and of the one after it.
+    int Pos;
+    int End;
+    // Whether an island may follow the line, and whether it does so without
+    // a branch around it.
+    bool Splittable;
+    bool Final;
+    uint64_t Frequency = 0;
+    SmallVector<unsigned, 1> Refs;
+    LC3Code Island;
+  };
+  std::vector<LC3MachineInst> &Insts = Code.getInsts();
+  std::vector<LC3Line> Lines;
+  Lines.reserve(Insts.size());
+  int Pos = 0;
+  bool Final = false;
+  for (auto &MI : Insts) {
+    // Blank and comment lines keep following the instruction before them.
+    Final = !MI.Pinned &&
+            (MI.isFinal() || (Final && (MI.Kind == LC3MachineInst::Blank ||
+                                        MI.Kind == LC3MachineInst::Comment)));
+    LC3Line Line = {Pos, Pos + MI.getWords(), !MI.Pinned, Final};
+    for (StringRef Operand : MI.Operands) {
+      unsigned ID;
+      if (Operand.size() > 2 && Operand.front() == RefMark &&
+          !Operand.slice(1, Operand.size() - 1).getAsInteger(10, ID)) {
+        Line.Refs.push_back(ID);
+      }
+    }
+    if (Frequency) {
+      Line.Frequency = Frequency(MI);
+      if (!Line.Frequency && !Lines.empty()) {
+        Line.Frequency = Lines.back().Frequency;
+      }
+    }
+    Pos = Line.End;
+    Lines.push_back(std::move(Line));
+  }
+
+  int NumLines = Lines.size();
+  // The lines before the first known frequency run as often as that one.
+  auto Known = find_if(Lines, [](LC3Line &Line) { return Line.Frequency; });
+  if (Known != Lines.end()) {
+    for (auto It = Lines.begin(); It != Known; ++It) {
+      It->Frequency = Known->Frequency;
+    }
+  }
+  std::vector<int> NextSplit(NumLines, NumLines - 1);
+  std::vector<int> NextFinal(NumLines, NumLines - 1);
+  for (int Line = NumLines - 2; Line >= 0; Line--) {
+    auto &Next = Lines[Line + 1];
+    NextSplit[Line] = Next.Splittable ? Line + 1 : NextSplit[Line + 1];
+    NextFinal[Line] = Next.Final ? Line + 1 : NextFinal[Line + 1];
+  }
+
+  // Address of the first line, moved by the islands placed so far.
+  int Base = Addr;
+  // Entries to place in the next island, in the order of their first uses.
+  SmallVector<unsigned, 16> Pending;
+  DenseMap<unsigned, int> FirstUse;
+  SmallVector<std::pair<int, unsigned>, 16> PendingRefs;
+
+  auto IsReachable = [&](unsigned ID, int RefAddr) {
+    return Entries[ID].Addr >= 0 &&
+           Entries[ID].Addr - (RefAddr + 1) >= MinOffset;
+  };
+  auto Bind = [&](int Line, unsigned ID) {
+    std::string Ref = RefMark + std::to_string(ID) + RefMark;
+    for (std::string &Operand : Insts[Line].Operands) {
+      if (Operand == Ref) {
+        Operand = "VALUE_" + std::to_string(Entries[ID].Label);
+      }
+    }
+  };
+  // Returns true if the pending entries, with the ones the lines up to To
+  // add, still fit an island after To.
+  auto CanWait = [&](int From, int To) {
+    SmallVector<unsigned, 16> Order(Pending.begin(), Pending.end());
+    DenseMap<unsigned, int> First(FirstUse);
+    for (int Line = From + 1; Line <= To; Line++) {
+      int RefAddr = Base + Lines[Line].Pos;
+      for (unsigned ID : Lines[Line].Refs) {
+        if (!First.count(ID) && !IsReachable(ID, RefAddr)) {
+          Order.push_back(ID);
+          First[ID] = RefAddr;
+        }
+      }
+    }
+    int EntryAddr = Base + Lines[To].End + !Lines[To].Final;
+    for (unsigned ID : Order) {
+      if (EntryAddr - (First[ID] + 1) > MaxOffset) {
+        return false;
+      }
+      EntryAddr += Entries[ID].Words;
+    }
+    return true;
+  };
+  // Returns true if an island after Line, splittable, is the one its
+  // entries need that runs its branch the least often. Lines after it are
+  // only better while the code does not stop falling through before them,
+  // and the entries still reach from them.
+  auto IsColdest = [&](int Line) {
+    if (!Frequency || CanWait(Line, NextFinal[Line])) {
+      return false;
+    }
+    for (int Next = NextSplit[Line];
+         Next < NextFinal[Line] && CanWait(Line, Next);
+         Next = NextSplit[Next]) {
+      if (Lines[Next].Frequency <= Lines[Line].Frequency) {
+        return false;
+      }
+    }
+    return true;
+  };
+  auto Place = [&](int Line, bool Skip) {
+    if (!Skip) {
+      while (Line + 1 < NumLines &&
+             Insts[Line + 1].Kind == LC3MachineInst::Blank) {
+        Line++;
+      }
+    }
+    LC3Code &Island = Lines[Line].Island;
+    int EntryAddr = Base + Lines[Line].End + Skip;
+    NumIslands++;
+    std::string End = "ISLAND_END_" + std::to_string(NumIslands);
+    if (Skip) {
+      Island.emitBranch("", End);
+    }
+    if (!NoComment) {
+      Island.emitComment("\tconstant island");
+    }
+    for (unsigned ID : Pending) {
+      Entries[ID].Label = ++LabelCounter;
+      Entries[ID].Addr = EntryAddr;
+      Island.emitLabel("VALUE_" + Twine(Entries[ID].Label));
+      Island.getInsts().push_back(Entries[ID].Directive);
+      EntryAddr += Entries[ID].Words;
+      PoolWords += Entries[ID].Words;
+    }
+    if (Skip) {
+      Island.emitLabel(End);
+    } else {
+      Island.emitBlank();
+    }
+    Base = EntryAddr - Lines[Line].End;
+    for (auto &Ref : PendingRefs) {
+      Bind(Ref.first, Ref.second);
+    }
+    Pending.clear();
+    FirstUse.clear();
+    PendingRefs.clear();
+  };
+
+  for (int Line = 0; Line < NumLines; Line++) {
+    int RefAddr = Base + Lines[Line].Pos;
+    for (unsigned ID : Lines[Line].Refs) {
+      if (FirstUse.count(ID)) {
+        PendingRefs.push_back({Line, ID});
+      } else if (IsReachable(ID, RefAddr)) {
+        Bind(Line, ID);
+      } else {
+        Pending.push_back(ID);
+        FirstUse[ID] = RefAddr;
+        PendingRefs.push_back({Line, ID});
+      }
+    }
+    if (Pending.empty()) {
+      continue;
+    }
+    // Wait for the next point the code does not fall through while the
+    // entries still reach, and split the code when they would not.
+    if (Line == NumLines - 1) {
+      Place(Line, !Lines[Line].Final);
+    } else if (Lines[Line].Final) {
+      if (!CanWait(Line, NextFinal[Line])) {
+        Place(Line, false);
+      }
+    } else if (Lines[Line].Splittable &&
+               (!CanWait(Line, NextSplit[Line]) || IsColdest(Line))) {
+      Place(Line, true);
+    }
+  }
+  Addr = Base + Pos;
+
+  for (int Line = 0; Line < NumLines; Line++) {
+    Out.getInsts().push_back(std::move(Insts[Line]));
+    Out.append(Lines[Line].Island);
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef LC3CONSTANTPOOL_H
+#define LC3CONSTANTPOOL_H
+
+#include "LC3MachineInst.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// Constant pool shared by all the functions of a module.
+//
+// The lowering refers to the words of the pool through placeholders, each
+// constant and string having a single entry. Once the code of a function is
+// complete, layout() walks it in address order and binds every reference to
+// a copy of its entry in reach of the 9-bit PC offset of LD, LEA and STI:
+// the last copy placed if it is close enough behind, otherwise a new one in
+// an island placed after the reference. Islands go after the instructions
+// that do not fall through when one is near enough, or behind a BR around
+// them otherwise. Given the frequency of the lines, such a branch is run as
+// rarely as possible: the island goes after the coldest line the entries
+// still reach from.
+class LC3ConstantPool {
+public:
+  // Start is the address of the first word laid out, relative to .ORIG.
+  explicit LC3ConstantPool(int Start) : Addr(Start) {}
+
+  // Returns the operand referring to a word holding Val.
+  std::string addFill(int64_t Val);
+  // Returns the operand referring to a word holding the address of Label.
+  std::string addAddress(StringRef Label);
+  // Returns the operand referring to the zero terminated string Str.
+  std::string addString(StringRef Str);
+
+  // Starts a basic block. Only used for the statistics, to count the words
+  // one pool per block would take.
+  void startBlock() { BlockEntries.clear(); }
+  // Binds the references of Code and appends it to Out with the islands
+  // they need. Islands are never placed between pinned lines. Frequency
+  // gives how often a line runs, if known, 0 meaning as the line next to
+  // it.
+  void layout(
+      LC3Code &Code, LC3Code &Out, bool NoComment,
+      function_ref<uint64_t(const LC3MachineInst &)> Frequency = nullptr);
+
+  int getNumIslands() const { return NumIslands; }
+  int getPoolWords() const { return PoolWords; }
+  int getBlockPoolWords() const { return BlockPoolWords; }
+
+private:
+  struct LC3PoolEntry {
+    LC3MachineInst Directive;
+    int Words;
+    // Label and address of the last copy placed, -1 before the first one.
+    int Label = -1;
+    int Addr = -1;
+  };
+
+  std::string addEntry(StringRef Op, const std::string &Operand, int Words);
+
+  std::vector<LC3PoolEntry> Entries;
+  StringMap<unsigned> EntryMap;
+  DenseSet<unsigned> BlockEntries;
+  int Addr;
+  int LabelCounter = 0;
+  int NumIslands = 0;
+  int PoolWords = 0;
+  int BlockPoolWords = 0;
+};
+
+} // namespace llvm
+
+#endif // LC3CONSTANTPOOL_H
@@ -0,0 +1,237 @@
+#include "LC3MachineInst.h"
+#include "llvm/ADT/StringExtras.h"
+
+using namespace llvm;
+
+bool LC3MachineInst::setsCondCodes() const {
+  return Kind == Inst && (Op == "ADD" || Op == "AND" || Op == "NOT" ||
+                          Op == "LD" || Op == "LDR" || Op == "LDI");
+}
+
+int LC3MachineInst::getDefReg() const {
+  if (Kind != Inst || Operands.empty()) {
+    return -1;
+  }
+  if (setsCondCodes() || Op == "LEA") {
+    return getReg(Operands[0]);
+  }
+  return -1;
+}
+
+// Returns the words a .BLKW of Count takes, all of them if it is not valid.
+static int getBlockWords(StringRef Count) {
+  unsigned Words;
+  Count = Count.trim();
+  Count.consume_front("#");
+  if ((Count.consume_front("X") || Count.consume_front("x"))
+          ? Count.getAsInteger(16, Words)
+          : Count.getAsInteger(10, Words)) {
+    return 0xFFFF;
+  }
+  return Words;
+}
+
+// Returns an upper bound of the words the raw line Line takes, the layout
+// stays correct when some of them are not there.
+static int getRawWords(StringRef Line) {
+  std::string Upper = Line.split(';').first.upper();
+  StringRef Text = StringRef(Upper).rtrim();
+  if (Text.contains(".STRINGZ")) {
+    return Line.size();
+  }
+  if (size_t Pos = Text.find(".BLKW"); Pos != StringRef::npos) {
+    return getBlockWords(Text.substr(Pos + 5));
+  }
+  if (Text.empty() || Text.contains(".ORIG") || Text.contains(".END")) {
+    return 0;
+  }
+  if (!isSpace(Text[0])) {
+    // A label, maybe followed by an instruction.
+    return Text.find_first_of(" \t") != StringRef::npos;
+  }
+  return 1;
+}
+
+int LC3MachineInst::getWords() const {
+  if (Kind == Raw) {
+    return getRawWords(Text);
+  }
+  if (Kind != Inst || Op == ".ORIG" || Op == ".END") {
+    return 0;
+  }
+  if (Op == ".STRINGZ" && !Operands.empty()) {
+    // The string between its quotes, then a terminating zero.
+    return Operands[0].size() - 1;
+  }
+  if (Op == ".BLKW" && !Operands.empty()) {
+    return getBlockWords(Operands[0]);
+  }
+  return 1;
+}
+
+int LC3MachineInst::getCycles(int MemCycles) const {
+  // Fetch and decode, then the execution.
+  int Fetch = 3 + MemCycles;
+  if (Kind == Raw) {
+    bool IsDirective = StringRef(Text).split(';').first.contains('.');
+    return getWords() && !IsDirective ? Fetch + 3 + 2 * MemCycles : 0;
+  }
+  if (Kind != Inst || Op.empty() || Op[0] == '.') {
+    return 0;
+  }
+  if (Op == "ADD" || Op == "AND" || Op == "NOT" || Op == "JMP" ||
+      Op == "RET" || Op == "LEA") {
+    return Fetch + 1;
+  }
+  if (Op == "BR" || Op == "JSR" || Op == "JSRR") {
+    return Fetch + 2;
+  }
+  if (Op == "LDI" || Op == "STI") {
+    return Fetch + 3 + 2 * MemCycles;
+  }
+  // LD, LDR, ST, STR, and TRAP with its aliases reading the trap vector.
+  return Fetch + 2 + MemCycles;
+}
+
+int LC3MachineInst::getReg(StringRef Operand) {
+  if (Operand.size() == 2 && (Operand[0] == 'R' || Operand[0] == 'r') &&
+      Operand[1] >= '0' && Operand[1] <= '7') {
+    return Operand[1] - '0';
+  }
+  return -1;
+}
+
+std::string llvm::regOp(int Reg) { return "R" + std::to_string(Reg); }
+
+std::string llvm::immOp(int64_t Imm) { return "#" + std::to_string(Imm); }
+
+void LC3Code::add(LC3MachineInst MI) {
+  MI.Source = Source;
+  Insts.push_back(std::move(MI));
+}
+
+void LC3Code::emit(StringRef Op, ArrayRef<std::string> Operands) {
+  add({LC3MachineInst::Inst,
+       Op.str(),
+       "",
+       {Operands.begin(), Operands.end()},
+       ""});
+}
+
+void LC3Code::emitBranch(StringRef CondCodes, const Twine &Target) {
+  add({LC3MachineInst::Inst, "BR", CondCodes.str(), {Target.str()}, ""});
+}
+
+void LC3Code::emitLabel(const Twine &Name) {
+  add({LC3MachineInst::Label, "", "", {}, Name.str()});
+}
+
+void LC3Code::emitComment(const Twine &Text) {
+  std::string Str = Text.str();
+  SmallVector<StringRef, 4> Lines;
+  StringRef(Str).split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    Insts.push_back({LC3MachineInst::Comment, "", "", {}, Line.str()});
+  }
+}
+
+void LC3Code::emitBlank() { Insts.push_back({LC3MachineInst::Blank}); }
+
+void LC3Code::emitMark(StringRef Name) {
+  Insts.push_back({LC3MachineInst::Mark, "", "", {}, Name.str()});
+}
+
+void LC3Code::append(const LC3Code &Code) {
+  Insts.insert(Insts.end(), Code.Insts.begin(), Code.Insts.end());
+}
+
+void LC3Code::pin(size_t From) {
+  for (size_t Index = From; Index < Insts.size(); Index++) {
+    Insts[Index].Pinned = true;
+  }
+}
+
+void LC3Code::replaceMarks(StringRef Name, const LC3Code &Code) {
+  std::vector<LC3MachineInst> Replaced;
+  Replaced.reserve(Insts.size());
+  for (auto &MI : Insts) {
+    if (MI.Kind == LC3MachineInst::Mark && MI.Text == Name) {
+      Replaced.insert(Replaced.end(), Code.Insts.begin(), Code.Insts.end());
+    } else {
+      Replaced.push_back(std::move(MI));
+    }
+  }
+  Insts = std::move(Replaced);
+}
+
+std::vector<LC3MachineInst> llvm::parseLC3(StringRef Asm) {
+  std::vector<LC3MachineInst> Insts;
+  SmallVector<StringRef, 64> Lines;
+  Asm.split(Lines, '\n');
+  if (!Lines.empty() && Lines.back().empty()) {
+    Lines.pop_back();
+  }
+  for (StringRef Line : Lines) {
+    LC3MachineInst MI = {LC3MachineInst::Raw, "", "", {}, Line.str()};
+    StringRef Text = Line.trim();
+    if (Text.empty()) {
+      MI = {LC3MachineInst::Blank};
+    } else if (Text.front() == ';') {
+      MI.Kind = LC3MachineInst::Comment;
+      MI.Text = Line.split(';').second.str();
+    } else if (!isSpace(Line.front())) {
+      // Labels followed by an instruction are left as they are.
+      if (Text.find_first_of(" \t") == StringRef::npos) {
+        MI.Kind = LC3MachineInst::Label;
+      }
+    } else if (!Text.contains(';') && !Text.contains('"')) {
+      MI.Kind = LC3MachineInst::Inst;
+      MI.Text.clear();
+      size_t Pos = Text.find_first_of(" \t");
+      MI.Op = Text.substr(0, Pos).upper();
+      StringRef Codes = StringRef(MI.Op).drop_front(2);
+      if (StringRef(MI.Op).startswith("BR") &&
+          Codes.find_first_not_of("NZP") == StringRef::npos) {
+        MI.CondCodes = Codes.lower();
+        MI.Op = "BR";
+      }
+      SmallVector<StringRef, 3> Operands;
+      if (Pos != StringRef::npos) {
+        Text.substr(Pos).split(Operands, ',');
+      }
+      for (StringRef Operand : Operands) {
+        MI.Operands.push_back(Operand.trim().str());
+      }
+    }
+    Insts.push_back(std::move(MI));
+  }
+  return Insts;
+}
+
+void llvm::printLC3(const LC3MachineInst &MI, raw_ostream &OS) {
+  switch (MI.Kind) {
+  case LC3MachineInst::Inst: {
+    OS << "\t" << MI.Op << MI.CondCodes;
+    size_t Width = MI.Op.size() + MI.CondCodes.size();
+    for (size_t i = 0; i < MI.Operands.size(); i++) {
+      OS << (i ? ", " : Width < 4 ? "\t\t" : "\t") << MI.Operands[i];
+    }
+    break;
+  }
+  case LC3MachineInst::Comment:
+    OS << ";" << MI.Text;
+    break;
+  case LC3MachineInst::Blank:
+  case LC3MachineInst::Mark:
+    break;
+  default:
+    OS << MI.Text;
+  }
+  OS << "\n";
+}
+
+void llvm::printLC3(ArrayRef<LC3MachineInst> Insts, raw_ostream &OS) {
+  for (auto &MI : Insts) {
+    printLC3(MI, OS);
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef LC3MACHINEINST_H
+#define LC3MACHINEINST_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+class Instruction;
+
+// One line of LC-3 assembly: an instruction or a directive with its
+// operands, a label, a comment or a blank line. Lines of assembly the pass
+// does not generate itself are kept as Raw text when they do not fit the
+// others. A Mark stands for code that is not known yet, replaced before the
+// code is printed.
+struct LC3MachineInst {
+  enum KindTy { Inst, Label, Comment, Blank, Raw, Mark };
+
+  KindTy Kind;
+  // Upper case opcode or directive, BR without its condition codes.
+  std::string Op;
+  // Lower case condition codes of a BR, empty when it always branches.
+  std::string CondCodes;
+  // Registers, immediates, labels and constant pool references, as written.
+  SmallVector<std::string, 3> Operands;
+  // Label name, text of a comment without its ';', raw line or mark name.
+  std::string Text;
+  // Set on the lines the constant pool must not place an island in.
+  bool Pinned = false;
+  // IR instruction the line was generated for, if any.
+  const Instruction *Source = nullptr;
+
+  bool isInst(StringRef Opcode) const { return Kind == Inst && Op == Opcode; }
+  bool isBranch() const { return isInst("BR"); }
+  bool isUncondBranch() const {
+    return isBranch() && (CondCodes.empty() || CondCodes == "nzp");
+  }
+  // Returns true if the instruction does not fall through to the next one.
+  bool isFinal() const {
+    return isUncondBranch() || isInst("JMP") || isInst("RET");
+  }
+  // Returns true if the instruction sets the condition codes.
+  bool setsCondCodes() const;
+  // Returns the register the instruction writes, -1 for none. JSR, JSRR and
+  // TRAP are not handled here, they write R7 and whatever the callee does.
+  int getDefReg() const;
+  // Returns the number of words the line takes.
+  int getWords() const;
+  // Returns the most cycles the line takes in lc3-sim, a memory access
+  // taking MemCycles cycles: BRs are taken, TRAPs do not count their service
+  // routine. Raw lines count as LDIs, directives take none.
+  int getCycles(int MemCycles) const;
+
+  // Returns the number of the register operand Operand, -1 if it is not a
+  // register.
+  static int getReg(StringRef Operand);
+};
+
+// Operands of register Reg and of immediate Imm.
+std::string regOp(int Reg);
+std::string immOp(int64_t Imm);
+
+// Code being generated: the lines of a function, or a part of them, in
+// layout order. The blocks of the function start at its labels.
+class LC3Code {
+public:
+  void emit(StringRef Op, ArrayRef<std::string> Operands = {});
+  // Emits a BR on CondCodes, always taken when they are empty.
+  void emitBranch(StringRef CondCodes, const Twine &Target);
+  void emitLabel(const Twine &Name);
+  // Emits the comment Text, one line of it each.
+  void emitComment(const Twine &Text);
+  void emitBlank();
+  void emitMark(StringRef Name);
+  void append(const LC3Code &Code);
+  // Keeps the constant pool from splitting the lines from From on.
+  void pin(size_t From);
+  // Sets the IR instruction the lines emitted next are generated for.
+  void setSource(const Instruction *I) { Source = I; }
+  const Instruction *getSource() const { return Source; }
+
+  size_t size() const { return Insts.size(); }
+  bool empty() const { return Insts.empty(); }
+  std::vector<LC3MachineInst> &getInsts() { return Insts; }
+  const std::vector<LC3MachineInst> &getInsts() const { return Insts; }
+
+  // Replaces the marks Name with Code.
+  void replaceMarks(StringRef Name, const LC3Code &Code);
+
+private:
+  void add(LC3MachineInst MI);
+
+  std::vector<LC3MachineInst> Insts;
+  const Instruction *Source = nullptr;
+};
+
+// Splits the assembly Asm into its lines.
+std::vector<LC3MachineInst> parseLC3(StringRef Asm);
+// Writes MI as a line of assembly.
+void printLC3(const LC3MachineInst &MI, raw_ostream &OS);
+void printLC3(ArrayRef<LC3MachineInst> Insts, raw_ostream &OS);
+
+} // namespace llvm
+
+#endif // LC3MACHINEINST_H
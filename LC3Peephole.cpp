@@ -0,0 +1,375 @@
+#include "LC3Peephole.h"
+#include "llvm/ADT/StringMap.h"
+#include <tuple>
+
+using namespace llvm;
+
+// Returns true if nothing about the registers and the memory is known after
+// MI. Pinned lines are left as they are and not looked into.
+static bool isBarrier(const LC3MachineInst &MI) {
+  if (MI.Kind == LC3MachineInst::Label || MI.Kind == LC3MachineInst::Raw ||
+      MI.Pinned) {
+    return true;
+  }
+  return MI.isInst("JSR") || MI.isInst("JSRR") || MI.isInst("TRAP") ||
+         MI.isInst("PUTS") || MI.isInst("OUT") || MI.isInst("GETC") ||
+         MI.isInst("IN") || MI.isInst("HALT");
+}
+
+static bool isSkipped(const LC3MachineInst &MI) {
+  return MI.Kind == LC3MachineInst::Comment ||
+         MI.Kind == LC3MachineInst::Blank;
+}
+
+// Returns the index of the first line after Index that is not a comment or
+// a blank line.
+static size_t getNext(const std::vector<LC3MachineInst> &Insts,
+                      size_t Index) {
+  do {
+    Index++;
+  } while (Index < Insts.size() && isSkipped(Insts[Index]));
+  return Index;
+}
+
+// Returns true if the code after Index may read the condition codes the
+// instruction at Index sets. A branch reads them, one to a label too as the
+// code there may test them.
+static bool isCondCodesLive(const std::vector<LC3MachineInst> &Insts,
+                            size_t Index) {
+  for (Index = getNext(Insts, Index); Index < Insts.size();
+       Index = getNext(Insts, Index)) {
+    auto &MI = Insts[Index];
+    if (MI.Kind != LC3MachineInst::Inst || MI.isBranch()) {
+      return true;
+    }
+    if (MI.setsCondCodes() || MI.isInst("JSR") || MI.isInst("JSRR") ||
+        MI.isInst("JMP") || MI.isInst("RET")) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Frame slots are the only words the loads and the stores are moved around
+// for, memory mapped registers are never reached from R5 or R6.
+static bool isFrameAccess(const LC3MachineInst &MI) {
+  if (!(MI.isInst("LDR") || MI.isInst("STR")) || MI.Operands.size() != 3) {
+    return false;
+  }
+  int Base = LC3MachineInst::getReg(MI.Operands[1]);
+  return Base == 5 || Base == 6;
+}
+
+// Returns true if MI loads a word of the constant pool.
+static bool isConstantLoad(const LC3MachineInst &MI) {
+  return MI.isInst("LD") && MI.Operands.size() == 2 &&
+         StringRef(MI.Operands[1]).contains('\x01');
+}
+
+static bool isStore(const LC3MachineInst &MI) {
+  return MI.isInst("ST") || MI.isInst("STR") || MI.isInst("STI");
+}
+
+static bool isLoad(const LC3MachineInst &MI) {
+  return MI.isInst("LD") || MI.isInst("LDR") || MI.isInst("LDI");
+}
+
+static bool isSameAddress(const LC3MachineInst &A, const LC3MachineInst &B) {
+  return A.Operands.size() == B.Operands.size() &&
+         std::equal(A.Operands.begin() + 1, A.Operands.end(),
+                    B.Operands.begin() + 1);
+}
+
+static LC3MachineInst getCopy(int DstReg, int SrcReg) {
+  return {LC3MachineInst::Inst,
+          "ADD",
+          "",
+          {"R" + std::to_string(DstReg), "R" + std::to_string(SrcReg), "#0"},
+          ""};
+}
+
+void LC3Peephole::run(LC3Code &Code) {
+  std::vector<LC3MachineInst> &Insts = Code.getInsts();
+  // A few rounds are enough for the rules to enable each other.
+  for (int Round = 0; Round < 8; Round++) {
+    bool Changed = removeRedundantLoads(Insts);
+    Changed |= removeDeadStores(Insts);
+    Changed |= simplifyBranches(Insts);
+    Changed |= reuseNegations(Insts);
+    if (!Changed) {
+      break;
+    }
+  }
+}
+
+bool LC3Peephole::removeRedundantLoads(std::vector<LC3MachineInst> &Insts) {
+  bool Changed = false;
+  for (size_t Index = 0; Index < Insts.size(); Index++) {
+    auto &Load = Insts[Index];
+    bool IsConstant = isConstantLoad(Load);
+    if (Load.Pinned ||
+        (!IsConstant && !(isFrameAccess(Load) && Load.Op == "LDR"))) {
+      continue;
+    }
+    int Base = IsConstant ? -1 : LC3MachineInst::getReg(Load.Operands[1]);
+    // Find the last store or load of the word, while the register it holds
+    // is not written and no store may write the word.
+    int SrcReg = -1;
+    unsigned Written = 0;
+    for (size_t Prev = Index; Prev-- > 0;) {
+      auto &MI = Insts[Prev];
+      if (isSkipped(MI)) {
+        continue;
+      }
+      if (isBarrier(MI) || MI.isFinal()) {
+        break;
+      }
+      bool IsAccess = IsConstant ? MI.Op == "LD"
+                                 : (MI.Op == "STR" || MI.Op == "LDR");
+      if (IsAccess && isSameAddress(MI, Load)) {
+        SrcReg = LC3MachineInst::getReg(MI.Operands[0]);
+        if (SrcReg == Base && MI.Op == "LDR") {
+          SrcReg = -1;
+        }
+        break;
+      }
+      if (!IsConstant && isStore(MI) &&
+          !(MI.Op == "STR" && MI.Operands[1] == Load.Operands[1])) {
+        break;
+      }
+      int DefReg = MI.getDefReg();
+      if (DefReg >= 0) {
+        if (DefReg == Base) {
+          break;
+        }
+        Written |= 1 << DefReg;
+      }
+    }
+    if (SrcReg < 0 || Written >> SrcReg & 1) {
+      continue;
+    }
+    int DstReg = LC3MachineInst::getReg(Load.Operands[0]);
+    if (DstReg != SrcReg || isCondCodesLive(Insts, Index)) {
+      Load = getCopy(DstReg, SrcReg);
+    } else {
+      Insts.erase(Insts.begin() + Index);
+      Index--;
+    }
+    NumLoads++;
+    Changed = true;
+  }
+  return Changed;
+}
+
+bool LC3Peephole::removeDeadStores(std::vector<LC3MachineInst> &Insts) {
+  bool Changed = false;
+  for (size_t Index = 0; Index < Insts.size(); Index++) {
+    auto &Store = Insts[Index];
+    if (Store.Pinned || !isFrameAccess(Store) || Store.Op != "STR") {
+      continue;
+    }
+    int Base = LC3MachineInst::getReg(Store.Operands[1]);
+    bool IsDead = false;
+    for (size_t Next = getNext(Insts, Index); Next < Insts.size();
+         Next = getNext(Insts, Next)) {
+      auto &MI = Insts[Next];
+      if (MI.isInst("STR") && isSameAddress(MI, Store)) {
+        IsDead = true;
+        break;
+      }
+      if (isBarrier(MI) || MI.isBranch() || MI.isFinal() ||
+          (isLoad(MI) && !isConstantLoad(MI)) || MI.getDefReg() == Base) {
+        break;
+      }
+    }
+    if (IsDead) {
+      Insts.erase(Insts.begin() + Index);
+      Index--;
+      NumStores++;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+bool LC3Peephole::simplifyBranches(std::vector<LC3MachineInst> &Insts) {
+  bool Changed = false;
+  StringMap<size_t> Labels;
+  for (size_t Index = 0; Index < Insts.size(); Index++) {
+    if (Insts[Index].Kind == LC3MachineInst::Label) {
+      Labels[Insts[Index].Text] = Index;
+    }
+  }
+  // Branches to an unconditional branch go to its target.
+  for (auto &MI : Insts) {
+    if (MI.Pinned || !MI.isBranch() || MI.Operands.size() != 1) {
+      continue;
+    }
+    bool Chained = false;
+    for (int Hops = 0; Hops < 8; Hops++) {
+      auto It = Labels.find(MI.Operands[0]);
+      if (It == Labels.end()) {
+        break;
+      }
+      size_t Target = It->second;
+      while (Target < Insts.size() &&
+             (isSkipped(Insts[Target]) ||
+              Insts[Target].Kind == LC3MachineInst::Label)) {
+        Target++;
+      }
+      if (Target == Insts.size() || !Insts[Target].isUncondBranch() ||
+          Insts[Target].Operands[0] == MI.Operands[0]) {
+        break;
+      }
+      MI.Operands[0] = Insts[Target].Operands[0];
+      Chained = true;
+    }
+    if (Chained) {
+      NumBranches++;
+      Changed = true;
+    }
+  }
+  for (size_t Index = 0; Index < Insts.size(); Index++) {
+    auto &MI = Insts[Index];
+    if (MI.Pinned) {
+      continue;
+    }
+    // Branches to the labels right after them go nowhere.
+    if (MI.isBranch() && MI.Operands.size() == 1) {
+      bool IsNext = false;
+      for (size_t Next = Index + 1;
+           Next < Insts.size() && !IsNext &&
+           (isSkipped(Insts[Next]) ||
+            Insts[Next].Kind == LC3MachineInst::Label);
+           Next++) {
+        IsNext = Insts[Next].Kind == LC3MachineInst::Label &&
+                 Insts[Next].Text == MI.Operands[0];
+      }
+      if (IsNext) {
+        Insts.erase(Insts.begin() + Index);
+        Index--;
+        NumBranches++;
+        Changed = true;
+        continue;
+      }
+    }
+    // Nothing reaches the instructions between a final one and the next
+    // label.
+    if (MI.isFinal()) {
+      size_t Next = Index + 1;
+      while (Next < Insts.size() &&
+             Insts[Next].Kind != LC3MachineInst::Label &&
+             Insts[Next].Kind != LC3MachineInst::Raw && !Insts[Next].Pinned) {
+        if (Insts[Next].Kind == LC3MachineInst::Inst) {
+          Insts.erase(Insts.begin() + Next);
+          NumBranches++;
+          Changed = true;
+        } else {
+          Next++;
+        }
+      }
+    }
+  }
+  return Changed;
+}
+
+bool LC3Peephole::reuseNegations(std::vector<LC3MachineInst> &Insts) {
+  bool Changed = false;
+  // Values are numbered, a register holding Vals[Reg] and, when NegOf[Reg]
+  // is not -1, being the negation of value NegOf[Reg]. Frame slots keep the
+  // pair of the register stored to them.
+  int Vals[8];
+  int NegOf[8];
+  StringMap<std::pair<int, int>> Slots;
+  int NextVal = 0;
+  auto Set = [&](int Reg, std::pair<int, int> Val) {
+    std::tie(Vals[Reg], NegOf[Reg]) = Val;
+    if (Reg == 5 || Reg == 6) {
+      Slots.clear();
+    }
+  };
+  auto Def = [&](int Reg) { Set(Reg, {NextVal++, -1}); };
+  auto Reset = [&]() {
+    for (int Reg = 0; Reg < 8; Reg++) {
+      Def(Reg);
+    }
+  };
+  Reset();
+  for (size_t Index = 0; Index < Insts.size(); Index++) {
+    auto &MI = Insts[Index];
+    if (isSkipped(MI)) {
+      continue;
+    }
+    if (isBarrier(MI) || MI.isFinal()) {
+      Reset();
+      continue;
+    }
+    if (isFrameAccess(MI)) {
+      std::string Slot = MI.Operands[1] + MI.Operands[2];
+      int Reg = LC3MachineInst::getReg(MI.Operands[0]);
+      auto It = Slots.find(Slot);
+      if (MI.Op == "STR") {
+        Slots[Slot] = {Vals[Reg], NegOf[Reg]};
+      } else if (It != Slots.end()) {
+        Set(Reg, It->second);
+      } else {
+        Def(Reg);
+        if (Reg != 5 && Reg != 6) {
+          Slots[Slot] = {Vals[Reg], NegOf[Reg]};
+        }
+      }
+      continue;
+    }
+    if (isStore(MI)) {
+      Slots.clear();
+      continue;
+    }
+    int DstReg = MI.getDefReg();
+    if (DstReg < 0) {
+      continue;
+    }
+    int SrcReg = MI.Operands.size() > 1
+                     ? LC3MachineInst::getReg(MI.Operands[1])
+                     : -1;
+    if (MI.Op == "ADD" && SrcReg >= 0 && MI.Operands[2] == "#0") {
+      Set(DstReg, {Vals[SrcReg], NegOf[SrcReg]});
+      continue;
+    }
+    size_t Next = getNext(Insts, Index);
+    if (MI.Op != "NOT" || Next == Insts.size() ||
+        !Insts[Next].isInst("ADD") || Insts[Next].Operands.size() != 3 ||
+        Insts[Next].Operands[0] != MI.Operands[0] ||
+        Insts[Next].Operands[1] != MI.Operands[0] ||
+        Insts[Next].Operands[2] != "#1") {
+      Def(DstReg);
+      continue;
+    }
+    // The negation of SrcReg: look for a register holding it, preferring
+    // the destination.
+    int Holder = -1;
+    for (int Reg = 0; Reg < 8; Reg++) {
+      if ((NegOf[Reg] == Vals[SrcReg] || Vals[Reg] == NegOf[SrcReg]) &&
+          (Holder < 0 || Reg == DstReg)) {
+        Holder = Reg;
+      }
+    }
+    if (Holder < 0) {
+      int Val = Vals[SrcReg];
+      Def(DstReg);
+      NegOf[DstReg] = Val;
+      Index = Next;
+      continue;
+    }
+    // The copy left is seen next and updates the values.
+    if (Holder != DstReg || isCondCodesLive(Insts, Next)) {
+      Insts[Next] = getCopy(DstReg, Holder);
+    } else {
+      Insts.erase(Insts.begin() + Next);
+    }
+    Insts.erase(Insts.begin() + Index);
+    Index--;
+    NumNegations++;
+    Changed = true;
+  }
+  return Changed;
+}
@@ -0,0 +1,43 @@
+#ifndef LC3PEEPHOLE_H
+#define LC3PEEPHOLE_H
+
+#include "LC3MachineInst.h"
+#include <vector>
+
+namespace llvm {
+
+// Peephole optimizer run on the code of each function before the constant
+// pool lays it out.
+//
+// The rules only look at straight line code: a label, a pinned line, a call
+// or a trap ends what they know. Each one counts what it removed:
+//  - loads of a word a store or a load before them left in a register,
+//  - stores overwritten before anything may read them,
+//  - branches to an unconditional branch, which go to its target instead,
+//    branches to the next instruction and the code after a final one that
+//    no label makes reachable,
+//  - negations of a value some register already holds the negation of.
+class LC3Peephole {
+public:
+  void run(LC3Code &Code);
+
+  int getNumLoads() const { return NumLoads; }
+  int getNumStores() const { return NumStores; }
+  int getNumBranches() const { return NumBranches; }
+  int getNumNegations() const { return NumNegations; }
+
+private:
+  bool removeRedundantLoads(std::vector<LC3MachineInst> &Insts);
+  bool removeDeadStores(std::vector<LC3MachineInst> &Insts);
+  bool simplifyBranches(std::vector<LC3MachineInst> &Insts);
+  bool reuseNegations(std::vector<LC3MachineInst> &Insts);
+
+  int NumLoads = 0;
+  int NumStores = 0;
+  int NumBranches = 0;
+  int NumNegations = 0;
+};
+
+} // namespace llvm
+
+#endif // LC3PEEPHOLE_H
@@ -0,0 +1,346 @@
+#include "LC3RegAlloc.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+#include <algorithm>
+#include <climits>
+
+using namespace llvm;
+
+LC3RegAlloc::LC3RegAlloc(Function &F, LoopInfo &LI,
+                         const DenseMap<Instruction *, unsigned> &ClobberMap,
+                         const DenseSet<Value *> &MemoryValues,
+                         const DenseSet<Value *> &FoldedValues,
+                         const BlockFrequencyInfo *BFI)
+    : F(F), LI(LI), ClobberMap(ClobberMap), MemoryValues(MemoryValues),
+      FoldedValues(FoldedValues), BFI(BFI) {}
+
+int LC3RegAlloc::getReg(Value *Val) const {
+  auto It = IntervalMap.find(Val);
+  if (It == IntervalMap.end()) {
+    return -1;
+  }
+  return Intervals[It->second].Reg;
+}
+
+int LC3RegAlloc::getSlot(Value *Val) const {
+  auto It = IntervalMap.find(Val);
+  if (It == IntervalMap.end()) {
+    return -1;
+  }
+  return Intervals[It->second].Slot;
+}
+
+float LC3RegAlloc::getFrequency(const BasicBlock *BB) const {
+  if (BFI) {
+    return (float)BFI->getBlockFreq(BB).getFrequency() /
+           BFI->getBlockFreq(&F.getEntryBlock()).getFrequency();
+  }
+  float Frequency = 1;
+  for (unsigned Depth = std::min(LI.getLoopDepth(BB), 4u); Depth; Depth--) {
+    Frequency *= 8;
+  }
+  return Frequency;
+}
+
+void LC3RegAlloc::numberInstructions() {
+  int Index = 0;
+  for (auto &BB : F) {
+    int First = Index + 1;
+    for (auto &I : BB) {
+      InstIndex[&I] = ++Index;
+      if (unsigned Mask = ClobberMap.lookup(&I)) {
+        for (int Reg = 0; Reg < 8; Reg++) {
+          if (Mask & (1u << Reg)) {
+            ClobberPoints[Reg].push_back(Index);
+          }
+        }
+      }
+    }
+    BBRange[&BB] = {First, Index};
+  }
+  BusyRegs.assign(Index + 1, 0);
+}
+
+static bool isAllocatable(Value *Val, const DenseSet<Value *> &MemoryValues,
+                          const DenseSet<Value *> &FoldedValues) {
+  if (!isa<Argument>(Val) && !isa<Instruction>(Val)) {
+    return false;
+  }
+  if (isa<AllocaInst>(Val) || Val->getType()->isVoidTy() || Val->use_empty()) {
+    return false;
+  }
+  return !MemoryValues.count(Val) && !FoldedValues.count(Val);
+}
+
+void LC3RegAlloc::computeLiveness() {
+  auto AddInterval = [&](Value *Val, int Index) {
+    IntervalMap[Val] = Intervals.size();
+    Intervals.push_back({Val, Index, Index, 0});
+  };
+  for (auto &Arg : F.args()) {
+    if (isAllocatable(&Arg, MemoryValues, FoldedValues)) {
+      AddInterval(&Arg, 0);
+    }
+  }
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (isAllocatable(&I, MemoryValues, FoldedValues)) {
+        AddInterval(&I, InstIndex[&I]);
+      }
+    }
+  }
+
+  // Upward exposed uses and definitions of every block. PHIs are copied into
+  // at the end of their incoming blocks, so the incoming values are used
+  // there rather than in the block of the PHI.
+  unsigned NumValues = Intervals.size();
+  DenseMap<BasicBlock *, BitVector> Uses, Defs, LiveIn, LiveOut;
+  for (auto &BB : F) {
+    BitVector &Use = Uses[&BB];
+    BitVector &Def = Defs[&BB];
+    Use.resize(NumValues);
+    Def.resize(NumValues);
+    LiveIn[&BB].resize(NumValues);
+    LiveOut[&BB].resize(NumValues);
+    for (auto &I : BB) {
+      for (Value *Op : I.operands()) {
+        auto It = IntervalMap.find(Op);
+        if (It != IntervalMap.end() && !Def.test(It->second) &&
+            !isa<PHINode>(&I)) {
+          Use.set(It->second);
+        }
+      }
+      auto It = IntervalMap.find(&I);
+      if (It != IntervalMap.end()) {
+        Def.set(It->second);
+      }
+    }
+    for (BasicBlock *Succ : successors(&BB)) {
+      for (auto &PHIN : Succ->phis()) {
+        auto It = IntervalMap.find(PHIN.getIncomingValueForBlock(&BB));
+        if (It != IntervalMap.end() && !Def.test(It->second)) {
+          Use.set(It->second);
+        }
+      }
+    }
+  }
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (auto &BB : reverse(F)) {
+      BitVector Out(NumValues);
+      for (BasicBlock *Succ : successors(&BB)) {
+        Out |= LiveIn[Succ];
+      }
+      BitVector In = Out;
+      In.reset(Defs[&BB]);
+      In |= Uses[&BB];
+      if (In != LiveIn[&BB] || Out != LiveOut[&BB]) {
+        LiveIn[&BB] = In;
+        LiveOut[&BB] = Out;
+        Changed = true;
+      }
+    }
+  }
+
+  auto Extend = [&](unsigned ID, int Index) {
+    Intervals[ID].Start = std::min(Intervals[ID].Start, Index);
+    Intervals[ID].End = std::max(Intervals[ID].End, Index);
+  };
+  std::vector<float> Frequency(NumValues, 0);
+  for (auto &BB : F) {
+    auto Range = BBRange[&BB];
+    for (unsigned ID : LiveIn[&BB].set_bits()) {
+      Extend(ID, Range.first);
+    }
+    for (unsigned ID : LiveOut[&BB].set_bits()) {
+      Extend(ID, Range.second);
+    }
+    float BBFrequency = getFrequency(&BB);
+    for (auto &I : BB) {
+      int Index = InstIndex[&I];
+      for (Value *Op : I.operands()) {
+        auto It = IntervalMap.find(Op);
+        if (It != IntervalMap.end() && !isa<PHINode>(&I)) {
+          Extend(It->second, Index);
+          Frequency[It->second] += BBFrequency;
+        }
+      }
+      auto It = IntervalMap.find(&I);
+      if (It != IntervalMap.end() && !isa<PHINode>(&I)) {
+        Frequency[It->second] += BBFrequency;
+      }
+    }
+    // The copies into the PHIs of the successors read the incoming values
+    // and write the PHIs at the end of the block.
+    for (BasicBlock *Succ : successors(&BB)) {
+      for (auto &PHIN : Succ->phis()) {
+        for (Value *Val : {PHIN.getIncomingValueForBlock(&BB),
+                           static_cast<Value *>(&PHIN)}) {
+          auto It = IntervalMap.find(Val);
+          if (It != IntervalMap.end()) {
+            Extend(It->second, Range.second);
+            Frequency[It->second] += BBFrequency;
+          }
+        }
+      }
+    }
+  }
+  for (unsigned ID = 0; ID < NumValues; ID++) {
+    auto &Interval = Intervals[ID];
+    Interval.Frequency = Frequency[ID];
+    Interval.Weight = Frequency[ID] / (Interval.End - Interval.Start + 1);
+  }
+}
+
+// Returns true if Interval starts at the definition of its value rather than
+// in a block laid out before it, into which the value is live.
+bool LC3RegAlloc::startsAtDef(const LC3LiveInterval &Interval) const {
+  if (auto *I = dyn_cast<Instruction>(Interval.Val)) {
+    return InstIndex.lookup(I) == Interval.Start;
+  }
+  return true;
+}
+
+// The instruction defining a value may clobber the register it writes the
+// value to. A value live into the block at Start must survive a clobber by
+// the first instruction there.
+bool LC3RegAlloc::isClobbered(int Reg,
+                              const LC3LiveInterval &Interval) const {
+  auto &Points = ClobberPoints[Reg];
+  auto It = startsAtDef(Interval)
+                ? std::upper_bound(Points.begin(), Points.end(), Interval.Start)
+                : std::lower_bound(Points.begin(), Points.end(),
+                                   Interval.Start);
+  return It != Points.end() && *It <= Interval.End;
+}
+
+// Values used by the instruction that defines Cur may share a register or a
+// slot with it, the operands are read before the result is written. That does
+// not hold when Cur only starts there because it is live into a block laid
+// out before its definition.
+bool LC3RegAlloc::isExpired(const LC3LiveInterval &Prev,
+                            const LC3LiveInterval &Cur) const {
+  if (Prev.End != Cur.Start) {
+    return Prev.End < Cur.Start;
+  }
+  return startsAtDef(Cur);
+}
+
+int LC3RegAlloc::nextClobber(int Reg, int Index) const {
+  auto &Points = ClobberPoints[Reg];
+  auto It = std::upper_bound(Points.begin(), Points.end(), Index);
+  return It == Points.end() ? INT_MAX : *It;
+}
+
+void LC3RegAlloc::run() {
+  numberInstructions();
+  computeLiveness();
+
+  std::vector<unsigned> Order(Intervals.size());
+  for (unsigned ID = 0; ID < Order.size(); ID++) {
+    Order[ID] = ID;
+  }
+  std::stable_sort(Order.begin(), Order.end(), [&](unsigned A, unsigned B) {
+    return Intervals[A].Start < Intervals[B].Start;
+  });
+
+  std::vector<unsigned> Active;
+  for (unsigned ID : Order) {
+    LC3LiveInterval &Cur = Intervals[ID];
+
+    unsigned Used = 0;
+    Active.erase(std::remove_if(Active.begin(), Active.end(),
+                                [&](unsigned Other) {
+                                  return isExpired(Intervals[Other], Cur);
+                                }),
+                 Active.end());
+    for (unsigned Other : Active) {
+      Used |= 1u << Intervals[Other].Reg;
+    }
+
+    unsigned Candidates = 0;
+    for (int Reg = 0; Reg < 8; Reg++) {
+      if ((LC3AllocatableRegs & (1u << Reg)) && !isClobbered(Reg, Cur)) {
+        Candidates |= 1u << Reg;
+      }
+    }
+
+    // Prefer to keep arguments where the caller put them, otherwise take the
+    // register whose next clobber comes first, leaving the long free ranges
+    // to the values that need them.
+    int Hint = -1;
+    if (auto *Arg = dyn_cast<Argument>(Cur.Val)) {
+      Hint = Arg->getArgNo();
+    }
+    unsigned Free = Candidates & ~Used;
+    if (Hint >= 0 && (Free & (1u << Hint))) {
+      Cur.Reg = Hint;
+    } else if (Free) {
+      int BestNext = INT_MAX;
+      for (int Reg = 0; Reg < 8; Reg++) {
+        if (Free & (1u << Reg)) {
+          int Next = nextClobber(Reg, Cur.End);
+          if (Cur.Reg < 0 || Next < BestNext) {
+            Cur.Reg = Reg;
+            BestNext = Next;
+          }
+        }
+      }
+    } else {
+      // Spill whichever of the competing values is used least often per
+      // instruction it keeps a register busy.
+      auto Victim = Active.end();
+      for (auto It = Active.begin(); It != Active.end(); ++It) {
+        LC3LiveInterval &Other = Intervals[*It];
+        if ((Candidates & (1u << Other.Reg)) && Other.Weight < Cur.Weight &&
+            (Victim == Active.end() ||
+             Other.Weight < Intervals[*Victim].Weight)) {
+          Victim = It;
+        }
+      }
+      if (Victim == Active.end()) {
+        continue;
+      }
+      Cur.Reg = Intervals[*Victim].Reg;
+      Intervals[*Victim].Reg = -1;
+      Active.erase(Victim);
+    }
+    Active.push_back(ID);
+  }
+
+  assignSlots(Order);
+
+  for (auto &Interval : Intervals) {
+    if (Interval.Reg >= 0) {
+      for (int Index = Interval.Start; Index <= Interval.End; Index++) {
+        BusyRegs[Index] |= 1u << Interval.Reg;
+      }
+    }
+  }
+}
+
+void LC3RegAlloc::assignSlots(ArrayRef<unsigned> Order) {
+  // Order is sorted by start, so first fit needs no more slots than there
+  // are spilled values live at the same point.
+  std::vector<unsigned> SlotOwner;
+  for (unsigned ID : Order) {
+    LC3LiveInterval &Cur = Intervals[ID];
+    if (Cur.Reg >= 0) {
+      continue;
+    }
+    auto Free = find_if(SlotOwner, [&](unsigned Owner) {
+      return isExpired(Intervals[Owner], Cur);
+    });
+    if (Free == SlotOwner.end()) {
+      Cur.Slot = SlotOwner.size();
+      SlotOwner.push_back(ID);
+    } else {
+      Cur.Slot = Free - SlotOwner.begin();
+      *Free = ID;
+    }
+  }
+  NumSlots = SlotOwner.size();
+}
@@ -0,0 +1,101 @@
+#ifndef LC3REGALLOC_H
+#define LC3REGALLOC_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include <vector>
+
+namespace llvm {
+
+// Registers values may live in: R0-R4 and R7. R5 and R6 are the frame and
+// stack pointers.
+constexpr unsigned LC3AllocatableRegs = 0x9F;
+
+struct LC3LiveInterval {
+  Value *Val;
+  int Start;
+  int End;
+  float Weight;
+  float Frequency = 0;
+  int Reg = -1;
+  int Slot = -1;
+};
+
+// Linear scan register allocator over the SSA values of a function.
+//
+// Instructions are numbered in layout order, index 0 being the function
+// entry where the arguments arrive in R0-R4. Every value gets one interval
+// covering all the points where it is live, so a register is either owned by
+// a value for the whole interval or not at all. Values that do not get a
+// register live in their frame slot, as before.
+//
+// The lowering of some instructions needs fixed registers (the loops of mul,
+// udiv, the calling convention, ...). Those are passed in as clobber masks: a
+// value can not be kept in a register clobbered by an instruction it is live
+// across or used by. The value defined by the instruction itself is written
+// last, so it may still be given one of those registers.
+//
+// The values left in memory are colored the same way: values whose intervals
+// do not overlap share a spill slot. Values the lowering folds into their
+// only user are never computed and get neither.
+//
+// The uses of a value weigh as much as their block runs: as given by BFI for
+// a function with a profile, or guessed from the loop depth otherwise.
+class LC3RegAlloc {
+public:
+  LC3RegAlloc(Function &F, LoopInfo &LI,
+              const DenseMap<Instruction *, unsigned> &ClobberMap,
+              const DenseSet<Value *> &MemoryValues,
+              const DenseSet<Value *> &FoldedValues,
+              const BlockFrequencyInfo *BFI = nullptr);
+
+  void run();
+
+  // Returns the register of Val, or -1 if it lives in memory.
+  int getReg(Value *Val) const;
+  // Returns the spill slot of Val, or -1 if it is kept in a register.
+  int getSlot(Value *Val) const;
+  int getNumSlots() const { return NumSlots; }
+  int getIndex(Instruction *I) const { return InstIndex.lookup(I); }
+  // Estimated execution count of BB relative to the function entry.
+  float getFrequency(const BasicBlock *BB) const;
+  // Registers owned by some value at Index, including the operands and the
+  // result of the instruction there.
+  unsigned getBusyRegs(int Index) const { return BusyRegs[Index]; }
+  const std::vector<LC3LiveInterval> &getIntervals() const {
+    return Intervals;
+  }
+
+private:
+  void numberInstructions();
+  void computeLiveness();
+  void assignSlots(ArrayRef<unsigned> Order);
+  bool startsAtDef(const LC3LiveInterval &Interval) const;
+  bool isExpired(const LC3LiveInterval &Prev,
+                 const LC3LiveInterval &Cur) const;
+  bool isClobbered(int Reg, const LC3LiveInterval &Interval) const;
+  int nextClobber(int Reg, int Index) const;
+
+  Function &F;
+  LoopInfo &LI;
+  const DenseMap<Instruction *, unsigned> &ClobberMap;
+  const DenseSet<Value *> &MemoryValues;
+  const DenseSet<Value *> &FoldedValues;
+  const BlockFrequencyInfo *BFI;
+
+  DenseMap<Instruction *, int> InstIndex;
+  DenseMap<BasicBlock *, std::pair<int, int>> BBRange;
+  DenseMap<Value *, int> IntervalMap;
+  std::vector<LC3LiveInterval> Intervals;
+  std::vector<int> ClobberPoints[8];
+  std::vector<unsigned> BusyRegs;
+  int NumSlots = 0;
+};
+
+} // namespace llvm
+
+#endif // LC3REGALLOC_H
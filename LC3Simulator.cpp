@@ -0,0 +1,231 @@
+#include "LC3Simulator.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+
+using namespace llvm;
+
+// Device registers.
+static constexpr uint16_t DSR = 0xFE04;
+static constexpr uint16_t DDR = 0xFE06;
+static constexpr uint16_t MCR = 0xFFFE;
+
+// Returns the low Bits bits of Word, sign extended.
+static int getSignedField(uint16_t Word, int Bits) {
+  int Field = Word & ((1 << Bits) - 1);
+  return Field & (1 << (Bits - 1)) ? Field - (1 << Bits) : Field;
+}
+
+void LC3Simulator::load(uint16_t Origin, ArrayRef<uint16_t> Words) {
+  for (size_t Index = 0; Index < Words.size(); Index++) {
+    Memory[(Origin + Index) & 0xFFFF] = Words[Index];
+  }
+}
+
+uint16_t LC3Simulator::read(uint16_t Addr) {
+  NumReads++;
+  NumCycles += MemCycles;
+  if (Addr == DSR || Addr == MCR) {
+    return 0x8000;
+  }
+  return Memory[Addr];
+}
+
+void LC3Simulator::write(uint16_t Addr, uint16_t Val, raw_ostream &OS) {
+  NumWrites++;
+  NumCycles += MemCycles;
+  if (Addr == DDR) {
+    OS << char(Val);
+  } else if (Addr == MCR && !(Val & 0x8000)) {
+    Halted = true;
+  }
+  Memory[Addr] = Val;
+}
+
+void LC3Simulator::setCondCodes(uint16_t Val) {
+  CondCodes = Val & 0x8000 ? 4 : Val ? 1 : 2;
+}
+
+void LC3Simulator::enableProfile(ArrayRef<uint16_t> Entries) {
+  Profiling = true;
+  IsEntry.assign(0x10000, false);
+  for (uint16_t Entry : Entries) {
+    IsEntry[Entry] = true;
+  }
+  Executions.assign(0x10000, 0);
+  Cycles.assign(0x10000, 0);
+}
+
+int LC3Simulator::getFrame(int Parent, uint16_t Func) {
+  auto [It, Inserted] = FrameMap.try_emplace({Parent, Func}, Frames.size());
+  if (Inserted) {
+    Frames.push_back({Parent, Func});
+  }
+  return It->second;
+}
+
+void LC3Simulator::profile(uint16_t Addr, uint16_t Word, uint16_t PC,
+                           uint64_t Cost) {
+  Executions[Addr]++;
+  Cycles[Addr] += Cost;
+  StackCycles[{Frame, Addr}] += Cost;
+  switch (Word >> 12) {
+  case 0x4: // JSR, JSRR
+    Frame = getFrame(Frame, PC);
+    break;
+  case 0xC: // JMP
+    if ((Word >> 6 & 7) == 7) {
+      if (Frames[Frame].Parent != -1) {
+        Frame = Frames[Frame].Parent;
+      }
+      break;
+    }
+    [[fallthrough]];
+  case 0x0: // BR
+    if (PC != (uint16_t)(Addr + 1) && IsEntry[PC]) {
+      Frame = getFrame(Frames[Frame].Parent, PC);
+    }
+    break;
+  }
+}
+
+void LC3Simulator::forEachStack(
+    function_ref<void(ArrayRef<uint16_t>, uint16_t, uint64_t)> Fn) const {
+  std::vector<uint16_t> Funcs;
+  for (auto &[Key, Cost] : StackCycles) {
+    Funcs.clear();
+    for (int F = Key.first; F != -1; F = Frames[F].Parent) {
+      Funcs.push_back(Frames[F].Func);
+    }
+    std::reverse(Funcs.begin(), Funcs.end());
+    Fn(Funcs, Key.second, Cost);
+  }
+}
+
+bool LC3Simulator::run(uint16_t PC, uint64_t MaxInsts, raw_ostream &OS) {
+  uint16_t ReturnAddr = Regs[7];
+  if (Profiling && Frame == -1) {
+    Frame = getFrame(-1, PC);
+  }
+  for (uint64_t Count = 0; !Halted && PC != ReturnAddr; Count++) {
+    if (Count == MaxInsts) {
+      errs() << "Error: no HALT after " << MaxInsts << " instructions\n";
+      return false;
+    }
+    // Fetch, then decode, states 18, 33, 35 and 32.
+    uint16_t Word = Memory[PC];
+    uint16_t Addr = PC;
+    uint64_t Start = NumCycles;
+    NumInsts++;
+    NumCycles += 3 + MemCycles;
+    PC++;
+
+    unsigned DR = Word >> 9 & 7;
+    unsigned SR = Word >> 6 & 7;
+    uint16_t PCOffset9 = PC + getSignedField(Word, 9);
+    switch (Word >> 12) {
+    case 0x1: // ADD
+    case 0x5: // AND
+    {
+      uint16_t B = Word & 0x20 ? getSignedField(Word, 5) : Regs[Word & 7];
+      Regs[DR] = Word >> 12 == 1 ? Regs[SR] + B : Regs[SR] & B;
+      setCondCodes(Regs[DR]);
+      NumCycles += 1;
+      break;
+    }
+    case 0x9: // NOT
+      Regs[DR] = ~Regs[SR];
+      setCondCodes(Regs[DR]);
+      NumCycles += 1;
+      break;
+    case 0x0: // BR
+      NumCycles += 1;
+      if (DR & CondCodes) {
+        PC = PCOffset9;
+        NumCycles += 1;
+      }
+      break;
+    case 0xC: // JMP
+      PC = Regs[SR];
+      NumCycles += 1;
+      break;
+    case 0x4: // JSR, JSRR
+    {
+      uint16_t Target =
+          Word & 0x800 ? PC + getSignedField(Word, 11) : Regs[SR];
+      Regs[7] = PC;
+      PC = Target;
+      NumCycles += 2;
+      break;
+    }
+    case 0x2: // LD
+      Regs[DR] = read(PCOffset9);
+      setCondCodes(Regs[DR]);
+      NumCycles += 2;
+      break;
+    case 0xA: // LDI
+      Regs[DR] = read(read(PCOffset9));
+      setCondCodes(Regs[DR]);
+      NumCycles += 3;
+      break;
+    case 0x6: // LDR
+      Regs[DR] = read(Regs[SR] + getSignedField(Word, 6));
+      setCondCodes(Regs[DR]);
+      NumCycles += 2;
+      break;
+    case 0xE: // LEA
+      Regs[DR] = PCOffset9;
+      NumCycles += 1;
+      break;
+    case 0x3: // ST
+      write(PCOffset9, Regs[DR], OS);
+      NumCycles += 2;
+      break;
+    case 0xB: // STI
+      write(read(PCOffset9), Regs[DR], OS);
+      NumCycles += 3;
+      break;
+    case 0x7: // STR
+      write(Regs[SR] + getSignedField(Word, 6), Regs[DR], OS);
+      NumCycles += 2;
+      break;
+    case 0xF: // TRAP
+      read(Word & 0xFF);
+      NumCycles += 2;
+      Regs[7] = PC;
+      switch (Word & 0xFF) {
+      case 0x21: // OUT
+        OS << char(Regs[0]);
+        break;
+      case 0x22: // PUTS
+        for (uint16_t Char = Regs[0]; Memory[Char]; Char++) {
+          OS << char(Memory[Char]);
+        }
+        break;
+      case 0x24: // PUTSP
+        for (uint16_t Char = Regs[0]; Memory[Char]; Char++) {
+          OS << char(Memory[Char]);
+          if (Memory[Char] >> 8) {
+            OS << char(Memory[Char] >> 8);
+          }
+        }
+        break;
+      case 0x25: // HALT
+        Halted = true;
+        break;
+      default:
+        errs() << "Error: unsupported trap " << format("x%02X", Word & 0xFF)
+               << " at " << format("x%04X", Addr) << "\n";
+        return false;
+      }
+      break;
+    default:
+      errs() << "Error: unsupported instruction " << format("x%04X", Word)
+             << " at " << format("x%04X", Addr) << "\n";
+      return false;
+    }
+    if (Profiling) {
+      profile(Addr, Word, PC, NumCycles - Start);
+    }
+  }
+  return true;
+}
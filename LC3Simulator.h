@@ -0,0 +1,90 @@
+#ifndef LC3SIMULATOR_H
+#define LC3SIMULATOR_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+
+// Simulator of the LC-3 counting what a program costs.
+//
+// The trap routines are not simulated: OUT, PUTS, PUTSP and HALT are done
+// by the simulator itself, and only the TRAP instruction is counted. The
+// display registers are always ready. Returning from the code started, to
+// the R7 it is given, ends the run like HALT.
+//
+// The cycles are estimated from the states of the LC-3 microarchitecture
+// each instruction goes through, a memory access taking MemCycles cycles.
+//
+// When profiling, the executions and the cycles of every address are counted,
+// and the cycles of every call stack too. JSR and JSRR push the function they
+// call, RET pops it, and JMP or a taken BR to the entry of a function replaces
+// the top of the stack, as for a tail call.
+class LC3Simulator {
+public:
+  explicit LC3Simulator(unsigned MemCycles) : MemCycles(MemCycles) {}
+
+  // Loads Words at Origin.
+  void load(uint16_t Origin, ArrayRef<uint16_t> Words);
+  // Runs the code from PC, writing what it prints to OS. Returns false after
+  // reporting why if it does not halt within MaxInsts instructions or runs
+  // into one the simulator does not support.
+  bool run(uint16_t PC, uint64_t MaxInsts, raw_ostream &OS);
+
+  // Profiles the next runs, the functions starting at Entries.
+  void enableProfile(ArrayRef<uint16_t> Entries);
+  uint64_t getExecutions(uint16_t Addr) const { return Executions[Addr]; }
+  uint64_t getCycles(uint16_t Addr) const { return Cycles[Addr]; }
+  // Calls Fn with the functions of each stack, outermost first, the address
+  // run on top of it and the cycles it took there.
+  void forEachStack(function_ref<void(ArrayRef<uint16_t> Funcs, uint16_t Addr,
+                                      uint64_t Cycles)>
+                        Fn) const;
+
+  uint16_t getReg(unsigned Reg) const { return Regs[Reg]; }
+  uint64_t getNumInsts() const { return NumInsts; }
+  uint64_t getNumReads() const { return NumReads; }
+  uint64_t getNumWrites() const { return NumWrites; }
+  uint64_t getNumCycles() const { return NumCycles; }
+
+private:
+  uint16_t read(uint16_t Addr);
+  void write(uint16_t Addr, uint16_t Val, raw_ostream &OS);
+  void setCondCodes(uint16_t Val);
+  void profile(uint16_t Addr, uint16_t Word, uint16_t PC, uint64_t Cost);
+  int getFrame(int Parent, uint16_t Func);
+
+  // A function on a call stack, the stacks sharing their outer frames.
+  struct LC3Frame {
+    int Parent;
+    uint16_t Func;
+  };
+
+  unsigned MemCycles;
+  std::vector<uint16_t> Memory = std::vector<uint16_t>(0x10000);
+  uint16_t Regs[8] = {0, 0, 0, 0, 0, 0, 0, 0xFFFF};
+  // N, Z and P, as in the BR instruction.
+  unsigned CondCodes = 2;
+  bool Halted = false;
+  uint64_t NumInsts = 0;
+  uint64_t NumReads = 0;
+  uint64_t NumWrites = 0;
+  uint64_t NumCycles = 0;
+
+  bool Profiling = false;
+  std::vector<bool> IsEntry;
+  std::vector<uint64_t> Executions;
+  std::vector<uint64_t> Cycles;
+  std::vector<LC3Frame> Frames;
+  DenseMap<std::pair<int, uint16_t>, int> FrameMap;
+  int Frame = -1;
+  DenseMap<std::pair<int, uint16_t>, uint64_t> StackCycles;
+};
+
+} // namespace llvm
+
+#endif // LC3SIMULATOR_H
@@ -1,18 +1,41 @@
 #include "LLVMIRToLC3Pass.h"
+#include "LC3Assembler.h"
+#include "LC3ConstantPool.h"
+#include "LC3MachineInst.h"
+#include "LC3Peephole.h"
+#include "LC3RegAlloc.h"
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instruction.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/Casting.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
 #include <llvm/ADT/APInt.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
@@ -43,6 +66,68 @@ static cl::opt<bool>
               cl::desc("Use signed multiplication or not, default false"),
               cl::value_desc("signed-mul"), cl::init(false));
 
+static cl::opt<bool> StaticFrames(
+    "lc3-static-frames",
+    cl::desc("Give the functions that are not recursive a static frame "
+             "instead of one on the stack, default false"),
+    cl::value_desc("lc3-static-frames"), cl::init(false));
+
+static cl::opt<int> InlineSize(
+    "lc3-inline-size",
+    cl::desc("Inline the leaf functions whose code is at most this many "
+             "words larger than a call of them, default 8"),
+    cl::value_desc("lc3-inline-size"), cl::init(8));
+
+static cl::opt<int> InlineBudget(
+    "lc3-inline-budget",
+    cl::desc("Specify the words inlining may add to the program, 0 disables "
+             "it, default 1024"),
+    cl::value_desc("lc3-inline-budget"), cl::init(1024));
+
+static cl::opt<bool>
+    NoPeephole("no-peephole",
+               cl::desc("Do not run the peephole optimizer on the generated "
+                        "code"),
+               cl::value_desc("no-peephole"), cl::init(false));
+
+static cl::opt<bool>
+    EmitObject("lc3-obj",
+               cl::desc("Also assemble the program into a .obj and a .sym "
+                        "file, default false"),
+               cl::value_desc("lc3-obj"), cl::init(false));
+
+static cl::opt<bool> EmitMap(
+    "lc3-map",
+    cl::desc("Write a .map file giving the function, the source line and the "
+             "IR instruction of every word of the program, default false"),
+    cl::value_desc("lc3-map"), cl::init(false));
+
+static cl::opt<bool> Instrument(
+    "lc3-instrument",
+    cl::desc("Count the executions of every basic block in the program, "
+             "which prints the counts when main returns, default false"),
+    cl::value_desc("lc3-instrument"), cl::init(false));
+
+static cl::opt<std::string> ProfileFileName(
+    "lc3-profile",
+    cl::desc("Read the block counts of a run of the program from this file, "
+             "as lc3-sim or lc3-counters write them with -counts, to guide "
+             "the code generation"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<bool> EmitBounds(
+    "lc3-bounds",
+    cl::desc("Write a .bounds file with the worst-case stack words and cycles "
+             "of every function, and warn when the stack may reach the "
+             "program, default false"),
+    cl::value_desc("lc3-bounds"), cl::init(false));
+
+static cl::opt<int> MemCycles(
+    "lc3-mem-cycles",
+    cl::desc("Specify the cycles a memory access takes for -lc3-bounds, as "
+             "lc3-sim does with -mem-cycles, default 5"),
+    cl::value_desc("lc3-mem-cycles"), cl::init(5));
+
 static cl::opt<bool>
     NoComment("no-comment",
               cl::desc("Generate pure LC-3 assembly code without any comment"),
@@ -66,6 +151,65 @@ std::string getBBName(Value *Val) {
   return Name;
 }
 
+// Number of ADDs needed to bring Off into the [Min, Max] offset range of an
+// instruction, walking the base register 16 words down or 15 words up at a
+// time.
+int getOffsetSteps(int Off, int Min, int Max) {
+  if (Off < Min) {
+    return (Min - Off + 15) / 16;
+  }
+  if (Off > Max) {
+    return (Off - Max + 14) / 15;
+  }
+  return 0;
+}
+
+// Frame slot Slot is at R5 - Slot. Frames with a FrameSize are too large for
+// the 6-bit offsets of LDR and STR, their deepest slots are reached from
+// R6 = R5 - FrameSize instead.
+bool isFromR6(int Slot, int FrameSize, int Min, int Max) {
+  return FrameSize && getOffsetSteps(FrameSize - Slot, Min, Max) <
+                          getOffsetSteps(-Slot, Min, Max);
+}
+
+int getFrameAccessCost(int Slot, int FrameSize) {
+  int Off = isFromR6(Slot, FrameSize, -32, 31) ? FrameSize - Slot : -Slot;
+  return getOffsetSteps(Off, -32, 31);
+}
+
+// Marks standing in the code of a function until the registers its epilogue
+// restores are known: the shared epilogue, a return branching to it, and the
+// restore part of the epilogue before a tail call. The last one sets R5 back
+// to the frame after a call of a function with a static frame.
+static constexpr char EpilogueMark[] = "epilogue";
+static constexpr char ReturnMark[] = "return";
+static constexpr char RestoreMark[] = "restore";
+static constexpr char FrameBaseMark[] = "frame base";
+
+// Emits Op (LDR, STR or ADD for the address) between Reg and frame slot Slot.
+// Slots out of reach are addressed through TempReg, which may be Reg itself
+// unless Op is a STR.
+void emitFrameAccess(StringRef Op, int Reg, int Slot, int FrameSize,
+                     int TempReg, LC3Code &Code) {
+  int Min = Op == "ADD" ? -16 : -32;
+  int Max = Op == "ADD" ? 15 : 31;
+  int Base = 5;
+  int Off = -Slot;
+  if (isFromR6(Slot, FrameSize, Min, Max)) {
+    Base = 6;
+    Off = FrameSize - Slot;
+  }
+  for (; Off < Min; Off += 16) {
+    Code.emit("ADD", {regOp(TempReg), regOp(Base), immOp(-16)});
+    Base = TempReg;
+  }
+  for (; Off > Max; Off -= 15) {
+    Code.emit("ADD", {regOp(TempReg), regOp(Base), immOp(15)});
+    Base = TempReg;
+  }
+  Code.emit(Op, {regOp(Reg), regOp(Base), immOp(Off)});
+}
+
 std::string getIndex(BasicBlock *BB, DenseMap<Value *, std::string> &Map,
                      int &Counter) {
   if (Map.count(BB) == 0) {
@@ -75,20 +219,29 @@ std::string getIndex(BasicBlock *BB, DenseMap<Value *, std::string> &Map,
   return Map[BB];
 }
 
-int addImmidiate(Value *Val, raw_string_ostream &ImmBuffer,
-                 DenseMap<Value *, bool> &ImmFlag,
-                 DenseMap<Value *, int> &ImmMap, int &ImmCounter) {
+// Returns the pool reference to a word holding Val, or an empty string if it
+// is not a constant.
+std::string addImmidiate(Value *Val, LC3ConstantPool &Pool) {
   if (auto *ConstInt = dyn_cast<ConstantInt>(Val)) {
-    int ValID = getIndex(Val, ImmMap, ImmCounter);
-    if (!ImmFlag.count(Val)) {
-      ImmFlag[Val] = true;
-      int value = ConstInt->getSExtValue();
-      ImmBuffer << "VALUE_" << ValID << "\n"
-                << "\t.FILL\t#" << value << "\n";
-    }
-    return ValID;
+    return Pool.addFill(ConstInt->getSExtValue());
   }
-  return 0;
+  return "";
+}
+
+// Returns true if Val is a constant that fits the 5-bit immediate of ADD and
+// AND, setting Imm to it. A null pointer is 0.
+bool getImm5(Value *Val, int &Imm) {
+  if (isa<ConstantPointerNull>(Val)) {
+    Imm = 0;
+    return true;
+  }
+  auto *ConstInt = dyn_cast<ConstantInt>(Val);
+  if (!ConstInt || ConstInt->getSExtValue() < -16 ||
+      ConstInt->getSExtValue() > 15) {
+    return false;
+  }
+  Imm = ConstInt->getSExtValue();
+  return true;
 }
 
 StringRef getString(Value *Val) {
@@ -103,20 +256,14 @@ StringRef getString(Value *Val) {
   return StringRef("").rtrim('\0');
 }
 
-int addString(Value *Val, raw_string_ostream &ImmBuffer,
-              DenseMap<Value *, bool> &ImmFlag, DenseMap<Value *, int> &ImmMap,
-              int &ImmCounter) {
+// Returns the pool reference to the string Val points to, or an empty string
+// if it is not a constant string.
+std::string addString(Value *Val, LC3ConstantPool &Pool) {
   auto Str = getString(Val);
   if (Str.size() > 0) {
-    int ValID = getIndex(Val, ImmMap, ImmCounter);
-    if (!ImmFlag.count(Val)) {
-      ImmFlag[Val] = true;
-      ImmBuffer << "VALUE_" << ValID << "\n"
-                << "\t.STRINGZ\t\"" << Str << "\"\n";
-    }
-    return ValID;
+    return Pool.addString(Str);
   }
-  return 0;
+  return "";
 }
 
 auto UnsupportInst(Instruction &I) {
@@ -146,47 +293,1223 @@ std::string addPrefixInst(Instruction &I, StringRef Prefix) {
   return ResultStream.str();
 }
 
+// Shifts by a constant are unrolled into ADDs while that is shorter than the
+// loop.
+bool isUnrolledShl(BinaryOperator *BinOp) {
+  auto *ShiftAmt = dyn_cast<ConstantInt>(BinOp->getOperand(1));
+  return ShiftAmt &&
+         (ShiftAmt->getZExtValue() < 8 || ShiftAmt->getZExtValue() >= 16);
+}
+
+// Returns the operand a multiplication by a constant is lowered as an add and
+// shift chain of, with the digits of the constant from the lowest one in
+// Digits. The digits are binary, or signed when that needs fewer additions
+// and pays for negating the operand. Returns nullptr when the chain would be
+// longer than the multiplication loop.
+Value *getMulChain(BinaryOperator *BinOp, SmallVectorImpl<int> &Digits) {
+  Value *X = BinOp->getOperand(0);
+  auto *Factor = dyn_cast<ConstantInt>(BinOp->getOperand(1));
+  if (!Factor) {
+    X = BinOp->getOperand(1);
+    Factor = dyn_cast<ConstantInt>(BinOp->getOperand(0));
+  }
+  if (!Factor) {
+    return nullptr;
+  }
+
+  int64_t C = SignExtend64<16>(Factor->getZExtValue());
+  SmallVector<int, 17> Binary, Signed;
+  for (uint64_t Bits = C & 0xFFFF; Bits; Bits >>= 1) {
+    Binary.push_back(Bits & 1);
+  }
+  for (int64_t Rest = C; Rest; Rest >>= 1) {
+    int Digit = 0;
+    if (Rest & 1) {
+      Digit = 2 - (Rest & 3);
+      Rest -= Digit;
+    }
+    Signed.push_back(Digit);
+  }
+  auto GetLength = [](ArrayRef<int> Digits) -> int {
+    if (Digits.size() <= 1) {
+      return 1;
+    }
+    int Length = Digits.size() - 2;
+    for (int Digit : Digits) {
+      Length += Digit != 0;
+    }
+    return is_contained(Digits, -1) ? Length + 2 : Length;
+  };
+  ArrayRef<int> Best = Binary;
+  if (GetLength(Signed) < GetLength(Binary)) {
+    Best = Signed;
+  }
+  // About the size of the loop with its operands loaded.
+  if (GetLength(Best) > 18) {
+    return nullptr;
+  }
+  Digits.assign(Best.begin(), Best.end());
+  return X;
+}
+
+// Returns the condition codes of the difference of the operands of a compare
+// (the constant ones are negated already) for which the compare holds, or an
+// empty string for the predicates the pass does not support. Unsigned values
+// are treated as signed.
+StringRef getCondCodes(CmpInst::Predicate Pred) {
+  switch (Pred) {
+  case CmpInst::ICMP_EQ:
+    return "z";
+  case CmpInst::ICMP_NE:
+    return "np";
+  case CmpInst::ICMP_SGT:
+  case CmpInst::ICMP_UGT:
+    return "p";
+  case CmpInst::ICMP_SGE:
+  case CmpInst::ICMP_UGE:
+    return "zp";
+  case CmpInst::ICMP_SLT:
+  case CmpInst::ICMP_ULT:
+    return "n";
+  case CmpInst::ICMP_SLE:
+  case CmpInst::ICMP_ULE:
+    return "nz";
+  default:
+    return "";
+  }
+}
+
+// Returns the condition codes for which a branch on CondCodes is not taken.
+std::string invertCondCodes(StringRef CondCodes) {
+  std::string Inverted;
+  for (char CC : {'n', 'z', 'p'}) {
+    if (!CondCodes.contains(CC)) {
+      Inverted += CC;
+    }
+  }
+  return Inverted;
+}
+
+// Returns the conditional branch a compare is lowered together with: its only
+// user, right after it. The result of the compare is then never computed.
+BranchInst *getFusedBranch(ICmpInst *ICmpI) {
+  if (!ICmpI->hasOneUse()) {
+    return nullptr;
+  }
+  auto *BranchI = dyn_cast<BranchInst>(ICmpI->user_back());
+  if (!BranchI || BranchI != ICmpI->getNextNode()) {
+    return nullptr;
+  }
+  return BranchI;
+}
+
+// Returns the function a call right before the return of its result jumps to
+// instead of calling it, the returns of the callee then going straight back
+// to the caller of the function. A call of the function itself reuses its
+// frame. Other callees need a register for the jump that the callers do not
+// expect to be preserved, so they must take fewer arguments. They must also
+// leave R5 as the callers of the function expect, so functions that may get
+// a static frame, among StaticFuncs, only jump to themselves.
+Function *getTailCallee(CallInst *CallI,
+                        const DenseSet<Function *> &StaticFuncs) {
+  Function *Callee = CallI->getCalledFunction();
+  Function *Caller = CallI->getFunction();
+  auto *RetI = dyn_cast_or_null<ReturnInst>(CallI->getNextNode());
+  if (!Callee || Callee->isDeclaration() || CallI->arg_size() > 5 || !RetI ||
+      (RetI->getReturnValue() && RetI->getReturnValue() != CallI)) {
+    return nullptr;
+  }
+  if (Callee != Caller &&
+      (Callee->arg_size() >= Caller->arg_size() ||
+       StaticFuncs.count(Callee) || StaticFuncs.count(Caller))) {
+    return nullptr;
+  }
+  return Callee;
+}
+
 std::string addRegisterComment(Instruction &I) {
   std::string Buffer;
   raw_string_ostream BufferStream(Buffer);
 
   if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
     auto OpCode = BinOp->getOpcode();
+    SmallVector<int, 17> Digits;
     switch (OpCode) {
-    case Instruction::Sub:
-      BufferStream << ";\tR1: minuend, result\n"
-                   << ";\tR2: -subtrahend\n";
+    case Instruction::Mul:
+      if (getMulChain(BinOp, Digits)) {
+        return "";
+      }
+      BufferStream << "\tR0: current bit\n"
+                   << "\tR1: multiplicand, shifted left\n"
+                   << "\tR2: multiplier bits left\n"
+                   << "\tR3: result\n"
+                   << "\tR4: mask\n";
       break;
     case Instruction::UDiv:
-      BufferStream << ";\tR1: dividend\n"
-                   << ";\tR2: divisor\n"
-                   << ";\tR3: iterator, result\n";
-      break;
     case Instruction::URem:
-      BufferStream << ";\tR1: dividend, result\n"
-                   << ";\tR2: divisor\n"
-                   << ";\tR3: -divisor\n";
+      BufferStream << "\tR0: remainder - divisor\n"
+                   << "\tR1: dividend, quotient\n"
+                   << "\tR2: -divisor\n"
+                   << "\tR3: remainder\n"
+                   << "\tR4: -bits left\n";
       break;
     default:
       return "";
     }
-  } else if (auto *ICmpI = dyn_cast<ICmpInst>(&I)) {
-    BufferStream << ";\tR1: left\n"
-                 << ";\tR2: right\n"
-                 << ";\tR3: result(0:false, 1:true)\n";
   } else if (auto *SwitchI = dyn_cast<SwitchInst>(&I)) {
-    BufferStream << ";\tR1: set CC\n" << ";\tR7: save current label\n";
-  } else if (auto *BrI = dyn_cast<BranchInst>(&I)) {
-    if (BrI->isConditional()) {
-      BufferStream << ";\tR1: set CC\n" << ";\tR7: save current label\n";
+    BufferStream << "\tR1: set CC\n";
+  }
+  return BufferStream.str();
+}
+
+std::string getValueName(Value *Val) {
+  std::string Buffer;
+  raw_string_ostream BufferStream(Buffer);
+  Val->printAsOperand(BufferStream, false);
+  return BufferStream.str();
+}
+
+// Rewrites the instructions the lowering can not handle directly into ones it
+// can. Returns the first instruction that can not be rewritten, if any.
+Instruction *canonicalizeFunction(Function &F) {
+  LLVMContext &Ctx = F.getContext();
+  Type *WordTy = Type::getInt32Ty(Ctx);
+
+  for (auto &BB : F) {
+    for (auto &I : make_early_inc_range(BB)) {
+      if (auto *IntrI = dyn_cast<IntrinsicInst>(&I)) {
+        CmpInst::Predicate Pred;
+        switch (IntrI->getIntrinsicID()) {
+        case Intrinsic::smin:
+          Pred = CmpInst::ICMP_SLT;
+          break;
+        case Intrinsic::smax:
+          Pred = CmpInst::ICMP_SGT;
+          break;
+        case Intrinsic::umin:
+          Pred = CmpInst::ICMP_ULT;
+          break;
+        case Intrinsic::umax:
+          Pred = CmpInst::ICMP_UGT;
+          break;
+        case Intrinsic::lifetime_start:
+        case Intrinsic::lifetime_end:
+          IntrI->eraseFromParent();
+          continue;
+        default:
+          return &I;
+        }
+
+        IRBuilder<> Builder(IntrI);
+        Value *A = IntrI->getArgOperand(0);
+        Value *B = IntrI->getArgOperand(1);
+
+        Value *Cmp = Builder.CreateICmp(Pred, A, B);
+        Value *Select = Builder.CreateSelect(Cmp, A, B);
+
+        IntrI->replaceAllUsesWith(Select);
+        IntrI->eraseFromParent();
+      }
+    }
+  }
+
+  for (auto &BB : F) {
+    for (auto &I : make_early_inc_range(BB)) {
+      if (auto *ICmpI = dyn_cast<ICmpInst>(&I)) {
+        Value *FirVal = ICmpI->getOperand(0);
+        if (auto *ConstInt = dyn_cast<ConstantInt>(FirVal)) {
+          ICmpI->swapOperands();
+        }
+        auto Pred = ICmpI->getPredicate();
+        Value *A = ICmpI->getOperand(0);
+        Value *B = ICmpI->getOperand(1);
+        if (auto *ConstInt = dyn_cast<ConstantInt>(B)) {
+          IRBuilder<> Builder(ICmpI);
+
+          auto *NegativeConst =
+              ConstantInt::get(WordTy, -ConstInt->getSExtValue());
+          auto *II = Builder.CreateICmp(Pred, A, NegativeConst);
+
+          I.replaceAllUsesWith(II);
+          I.eraseFromParent();
+        }
+      } else if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
+        auto OpCode = BinOp->getOpcode();
+        Value *A = BinOp->getOperand(0);
+        Value *B = BinOp->getOperand(1);
+        switch (OpCode) {
+        case Instruction::Sub:
+          if (auto *ConstInt = dyn_cast<ConstantInt>(B)) {
+            IRBuilder<> Builder(BinOp);
+
+            auto *NegativeConst =
+                ConstantInt::get(WordTy, -ConstInt->getSExtValue());
+            auto *BI = Builder.CreateAdd(A, NegativeConst);
+
+            I.replaceAllUsesWith(BI);
+            I.eraseFromParent();
+          }
+          break;
+        default:
+          continue;
+        }
+      }
+    }
+  }
+
+  for (auto &BB : F) {
+    for (auto &I : make_early_inc_range(BB)) {
+      if (auto *BrI = dyn_cast<BranchInst>(&I)) {
+        if (BrI->isConditional()) {
+          Value *Cond = BrI->getCondition();
+
+          if (auto *ICmpI = dyn_cast<ICmpInst>(Cond)) {
+            auto Pred = ICmpI->getPredicate();
+            if (Pred == CmpInst::ICMP_EQ || Pred == CmpInst::ICMP_NE) {
+              Value *Val = ICmpI->getOperand(0);
+              Value *ConVal = ICmpI->getOperand(1);
+              if (auto *ConstInt = dyn_cast<ConstantInt>(ConVal)) {
+                // The constant of the compare is already negated.
+                IRBuilder<> Builder(BrI);
+                auto *CaseVal =
+                    ConstantInt::get(WordTy, -ConstInt->getSExtValue());
+                SwitchInst *SI = Builder.CreateSwitch(
+                    Val, BrI->getSuccessor(Pred == CmpInst::ICMP_EQ), 1);
+                SI->addCase(cast<ConstantInt>(CaseVal),
+                            BrI->getSuccessor(Pred == CmpInst::ICMP_NE));
+
+                BrI->eraseFromParent();
+                if (ICmpI->use_empty())
+                  ICmpI->eraseFromParent();
+              }
+            }
+          }
+        }
+      } else if (auto *TruncI = dyn_cast<TruncInst>(&I)) {
+        Value *Source = TruncI->getOperand(0);
+
+        TruncI->replaceAllUsesWith(Source);
+        TruncI->eraseFromParent();
+      } else if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
+        auto OpCode = BinOp->getOpcode();
+        Value *A = I.getOperand(0);
+        Value *B = I.getOperand(1);
+        switch (OpCode) {
+        case Instruction::Or:
+          if (auto *DisjointOp = dyn_cast<PossiblyDisjointInst>(BinOp)) {
+            if (!DisjointOp->isDisjoint()) {
+              continue;
+            }
+            IRBuilder<> Builder(&I);
+
+            Value *AddInst = Builder.CreateAdd(A, B);
+
+            I.replaceAllUsesWith(AddInst);
+            I.eraseFromParent();
+          }
+        default:
+          continue;
+        }
+      }
+    }
+  }
+
+  // Keep a udiv and a urem of the same operands next to each other, the
+  // lowering gets both from one division.
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      auto *BinOp = dyn_cast<BinaryOperator>(&I);
+      if (!BinOp || (BinOp->getOpcode() != Instruction::UDiv &&
+                     BinOp->getOpcode() != Instruction::URem)) {
+        continue;
+      }
+      auto Partner = BinOp->getOpcode() == Instruction::UDiv
+                         ? Instruction::URem
+                         : Instruction::UDiv;
+      for (auto &Other :
+           make_range(std::next(I.getIterator()), BB.end())) {
+        if (Other.getOpcode() == Partner &&
+            Other.getOperand(0) == I.getOperand(0) &&
+            Other.getOperand(1) == I.getOperand(1)) {
+          Other.moveAfter(&I);
+          break;
+        }
+      }
+    }
+  }
+
+  // PHIs are written by copies at the end of their incoming blocks, which
+  // therefore must not branch anywhere else.
+  for (auto &BB : F) {
+    if (BB.getSinglePredecessor()) {
+      FoldSingleEntryPHINodes(&BB);
+    }
+  }
+  SmallVector<std::pair<Instruction *, unsigned>, 8> CriticalEdges;
+  for (auto &BB : F) {
+    Instruction *TermI = BB.getTerminator();
+    for (unsigned i = 0; i < TermI->getNumSuccessors(); i++) {
+      BasicBlock *Succ = TermI->getSuccessor(i);
+      if (!Succ->phis().empty() && isCriticalEdge(TermI, i)) {
+        CriticalEdges.push_back({TermI, i});
+      }
+    }
+  }
+  for (auto &Edge : CriticalEdges) {
+    SplitCriticalEdge(Edge.first, Edge.second);
+  }
+  return nullptr;
+}
+
+// Reads the block counts of a profile, one "function<tab>block<tab>count"
+// line per block, the block named as by getBBName. Returns false after
+// reporting why if it can not.
+bool readBlockCounts(StringRef FileName, StringMap<uint64_t> &Counts) {
+  auto Buffer = MemoryBuffer::getFile(FileName);
+  if (!Buffer) {
+    errs() << "Error: " << FileName << ": " << Buffer.getError().message()
+           << "\n";
+    return false;
+  }
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    auto [Block, CountText] = Line.rtrim().rsplit('\t');
+    uint64_t Count;
+    if (!Block.contains('\t') || CountText.getAsInteger(10, Count)) {
+      errs() << "Error: " << FileName << ": not a block counts file\n";
+      return false;
+    }
+    Counts[Block] += Count;
+  }
+  return true;
+}
+
+// Gives F the entry count and the branch weights of its block counts, for
+// BlockFrequencyInfo and BranchProbabilityInfo to follow as they follow the
+// !prof metadata of a PGO build.
+//
+// The counts of the edges are inferred from the flow: a block with a known
+// count and a single edge in or out of unknown count gives that edge the
+// difference, a block with all its edges in or out known runs their sum.
+// The last unknown edges take the count of their successor, capped by the
+// one of their source. Blocks that took no words in the run profiled are
+// missing from the counts, and are inferred the same way.
+void applyBlockCounts(Function &F, const StringMap<uint64_t> &Counts) {
+  auto GetKey = [&](BasicBlock *BB) {
+    return (F.getName() + "\t" + getBBName(BB)).str();
+  };
+  if (!Counts.count(GetKey(&F.getEntryBlock()))) {
+    return;
+  }
+  DenseMap<BasicBlock *, uint64_t> BlockCounts;
+  for (auto &BB : F) {
+    if (auto It = Counts.find(GetKey(&BB)); It != Counts.end()) {
+      BlockCounts[&BB] = It->second;
+    }
+  }
+  struct LC3EdgeCount {
+    BasicBlock *Src;
+    BasicBlock *Dst;
+    std::optional<uint64_t> Count;
+  };
+  std::vector<LC3EdgeCount> Edges;
+  DenseMap<BasicBlock *, SmallVector<unsigned, 4>> InEdges;
+  DenseMap<BasicBlock *, SmallVector<unsigned, 4>> OutEdges;
+  DenseMap<std::pair<BasicBlock *, BasicBlock *>, unsigned> EdgeMap;
+  for (auto &BB : F) {
+    for (BasicBlock *Succ : successors(&BB)) {
+      if (EdgeMap.try_emplace({&BB, Succ}, Edges.size()).second) {
+        OutEdges[&BB].push_back(Edges.size());
+        InEdges[Succ].push_back(Edges.size());
+        Edges.push_back({&BB, Succ, std::nullopt});
+      }
+    }
+  }
+  auto Infer = [&](BasicBlock *BB, ArrayRef<unsigned> IDs) {
+    uint64_t Sum = 0;
+    SmallVector<unsigned, 2> Unknown;
+    for (unsigned ID : IDs) {
+      if (Edges[ID].Count) {
+        Sum += *Edges[ID].Count;
+      } else {
+        Unknown.push_back(ID);
+      }
+    }
+    auto It = BlockCounts.find(BB);
+    if (It == BlockCounts.end() && Unknown.empty() && !IDs.empty()) {
+      BlockCounts[BB] = Sum;
+      return true;
+    }
+    if (It != BlockCounts.end() && Unknown.size() == 1) {
+      Edges[Unknown[0]].Count = It->second > Sum ? It->second - Sum : 0;
+      return true;
+    }
+    return false;
+  };
+  for (bool Changed = true; Changed;) {
+    Changed = false;
+    for (auto &BB : F) {
+      Changed |= Infer(&BB, InEdges[&BB]);
+      Changed |= Infer(&BB, OutEdges[&BB]);
+    }
+  }
+
+  F.setEntryCount(BlockCounts[&F.getEntryBlock()]);
+  MDBuilder MDB(F.getContext());
+  for (auto &BB : F) {
+    Instruction *TermI = BB.getTerminator();
+    if (TermI->getNumSuccessors() < 2) {
+      continue;
+    }
+    SmallVector<uint32_t, 8> Weights;
+    for (BasicBlock *Succ : successors(&BB)) {
+      auto &Edge = Edges[EdgeMap[{&BB, Succ}]];
+      uint64_t Count = Edge.Count ? *Edge.Count
+                                  : std::min(BlockCounts.lookup(Succ),
+                                             BlockCounts.lookup(&BB));
+      Count /= count(successors(&BB), Succ);
+      Weights.push_back(std::min<uint64_t>(Count, UINT32_MAX - 1) + 1);
+    }
+    TermI->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(Weights));
+  }
+}
+
+// Returns the order to emit the blocks of F in, so that the most frequent
+// edges fall through. Chains of blocks are joined along the edges from the
+// most to the least frequent one, when the edge goes from the end of a chain
+// to the start of another. The chain of the entry block goes first, the others
+// keep the order of the blocks they start with. The register allocator still
+// numbers the blocks in IR order, which keeps the live ranges of loops short.
+std::vector<BasicBlock *> layoutBlocks(Function &F, BlockFrequencyInfo &BFI,
+                                       BranchProbabilityInfo &BPI) {
+  struct LC3Edge {
+    uint64_t Frequency;
+    BasicBlock *Src;
+    BasicBlock *Dst;
+  };
+  SmallVector<LC3Edge, 32> Edges;
+  std::vector<SmallVector<BasicBlock *, 8>> Chains;
+  DenseMap<BasicBlock *, unsigned> ChainMap;
+  for (auto &BB : F) {
+    ChainMap[&BB] = Chains.size();
+    Chains.push_back({&BB});
+    for (BasicBlock *Succ : successors(&BB)) {
+      if (Succ != &BB && !Succ->isEntryBlock()) {
+        BlockFrequency Frequency =
+            BFI.getBlockFreq(&BB) * BPI.getEdgeProbability(&BB, Succ);
+        Edges.push_back({Frequency.getFrequency(), &BB, Succ});
+      }
+    }
+  }
+  std::stable_sort(Edges.begin(), Edges.end(),
+                   [](const LC3Edge &A, const LC3Edge &B) {
+                     return A.Frequency > B.Frequency;
+                   });
+  for (auto &Edge : Edges) {
+    unsigned Src = ChainMap[Edge.Src];
+    unsigned Dst = ChainMap[Edge.Dst];
+    if (Src == Dst || Chains[Src].back() != Edge.Src ||
+        Chains[Dst].front() != Edge.Dst) {
+      continue;
+    }
+    for (BasicBlock *BB : Chains[Dst]) {
+      ChainMap[BB] = Src;
+    }
+    Chains[Src].append(Chains[Dst].begin(), Chains[Dst].end());
+    Chains[Dst].clear();
+  }
+
+  std::vector<BasicBlock *> Layout;
+  for (auto &Chain : Chains) {
+    Layout.insert(Layout.end(), Chain.begin(), Chain.end());
+  }
+  return Layout;
+}
+
+// Returns the registers the lowering of I needs for itself. Values live across
+// I or used by it can not be kept in them.
+unsigned getClobberedRegs(Instruction &I,
+                          const DenseSet<Function *> &StaticFuncs) {
+  if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
+    SmallVector<int, 17> Digits;
+    switch (BinOp->getOpcode()) {
+    case Instruction::Shl:
+      if (isUnrolledShl(BinOp)) {
+        return 0;
+      }
+      // R1, R2
+      return 0x06;
+    case Instruction::LShr:
+      // R0-R2 when the shift leaves four bits at most
+      if (auto *ShiftAmt = dyn_cast<ConstantInt>(BinOp->getOperand(1));
+          ShiftAmt && ShiftAmt->getZExtValue() >= 12) {
+        return 0x07;
+      }
+      // R0-R4
+      return 0x1F;
+    case Instruction::Mul:
+      if (getMulChain(BinOp, Digits)) {
+        return 0;
+      }
+      [[fallthrough]];
+    case Instruction::UDiv:
+    case Instruction::URem:
+      // R0-R4
+      return 0x1F;
+    default:
+      return 0;
+    }
+  } else if (isa<SwitchInst>(&I)) {
+    // R1, R2
+    return 0x06;
+  } else if (auto *CallI = dyn_cast<CallInst>(&I)) {
+    Function *Func = CallI->getCalledFunction();
+    if (!Func) {
+      return 0;
+    }
+    StringRef Name = Func->getName();
+    if (Name == "printStr" || Name == "printStrAddr" ||
+        Name == "printCharAddr" || Name == "printChar") {
+      // R0, R7
+      return 0x81;
+    }
+    if (Name == "integrateLC3Asm") {
+      return LC3AllocatableRegs;
+    }
+    if (Name == "dumpLC3Counters") {
+      // R7
+      return Instrument ? 0x80 : 0;
+    }
+    if (Name == "loadLabel" || Name == "loadAddr" || Name == "storeLabel" ||
+        Name == "storeAddr" || Name == "readLabelAddr") {
+      return 0;
+    }
+    // A tail call writes the arguments, and the register it jumps through
+    // unless it stays in the function.
+    if (Function *Callee = getTailCallee(CallI, StaticFuncs)) {
+      return (1u << (CallI->arg_size() + (Callee != CallI->getFunction()))) -
+             1;
+    }
+    // The arguments go in R0-R4, the result comes back in R0 and JSR
+    // overwrites R7. The callee restores everything else.
+    return 0x81 | ((1u << CallI->arg_size()) - 1);
+  }
+  return 0;
+}
+
+// Returns the estimated number of words the lowering of I takes, counting a
+// call as the call site only.
+int getLoweringSize(Instruction &I) {
+  if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
+    SmallVector<int, 17> Digits;
+    int Imm;
+    switch (BinOp->getOpcode()) {
+    case Instruction::Add:
+    case Instruction::And:
+      return getImm5(BinOp->getOperand(1), Imm) ? 1 : 2;
+    case Instruction::Sub:
+      return 3;
+    case Instruction::Or:
+      return 4;
+    case Instruction::Shl:
+      if (isUnrolledShl(BinOp)) {
+        return std::min<uint64_t>(
+            cast<ConstantInt>(BinOp->getOperand(1))->getZExtValue(), 16);
+      }
+      return 9;
+    case Instruction::Mul:
+      if (getMulChain(BinOp, Digits)) {
+        return 2 * Digits.size();
+      }
+      return SignedMul ? 25 : 19;
+    case Instruction::UDiv:
+    case Instruction::URem:
+      return 40;
+    case Instruction::LShr:
+      return 24;
+    default:
+      return 1;
+    }
+  }
+  if (auto *ICmpI = dyn_cast<ICmpInst>(&I)) {
+    return getFusedBranch(ICmpI) ? 3 : 6;
+  }
+  if (auto *SwitchI = dyn_cast<SwitchInst>(&I)) {
+    return 2 * SwitchI->getNumCases() + 2;
+  }
+  if (auto *CallI = dyn_cast<CallInst>(&I)) {
+    return CallI->arg_size() + 2;
+  }
+  if (isa<SelectInst>(&I)) {
+    return 4;
+  }
+  if (isa<AllocaInst>(&I) || isa<IntrinsicInst>(&I)) {
+    return 0;
+  }
+  return 1;
+}
+
+// Inlines the calls of small leaf functions, the ones calling no function of
+// the module, and removes the local ones no longer called. A call costs the
+// copies of its arguments and result and the JSR, the callee its prologue
+// and epilogue. Those save the registers it writes besides the arguments,
+// R5 and the frame pointer set up when it has locals. A callee is inlined
+// when its code is at most -lc3-inline-size words larger than that, while
+// the words added to the program stay within -lc3-inline-budget.
+void inlineSmallFunctions(Module &M) {
+  struct LC3InlineCost {
+    int Size;
+    int CallOverhead;
+  };
+  DenseMap<Function *, LC3InlineCost> Costs;
+  // Returns false if Callee can not be inlined.
+  auto GetCost = [&](Function *Callee, LC3InlineCost &Cost) {
+    if (auto It = Costs.find(Callee); It != Costs.end()) {
+      Cost = It->second;
+      return true;
+    }
+    if (Callee->isVarArg() || Callee->getName() == "main" ||
+        Callee->hasFnAttribute(Attribute::NoInline)) {
+      return false;
+    }
+    int Size = 0;
+    int NumValues = 0;
+    bool HasFrame = false;
+    unsigned Clobbers = 0;
+    for (auto &I : instructions(*Callee)) {
+      if (auto *CallI = dyn_cast<CallInst>(&I)) {
+        Function *Func = CallI->getCalledFunction();
+        // Inlined assembly may define labels, which must stay unique.
+        if (!Func || !Func->isDeclaration() ||
+            Func->getName() == "integrateLC3Asm") {
+          return false;
+        }
+      }
+      Size += getLoweringSize(I);
+      NumValues += !I.getType()->isVoidTy() && !isa<AllocaInst>(&I);
+      HasFrame |= isa<AllocaInst>(&I);
+      Clobbers |= getClobberedRegs(I, {});
+    }
+    unsigned SaveMask = 0x9E & ~((1u << Callee->arg_size()) - 1);
+    int NumSaved = std::min<int>(
+        countPopulation(SaveMask),
+        countPopulation(Clobbers & SaveMask) +
+            std::max<int>(NumValues - Callee->arg_size(), 0));
+    int Overhead = 1;
+    if (NumSaved || HasFrame) {
+      Overhead += 2 * (NumSaved + HasFrame + 1);
+    }
+    if (HasFrame) {
+      Overhead += 3;
+    }
+    Cost = Costs[Callee] = {Size, Overhead};
+    return true;
+  };
+
+  int Budget = InlineBudget;
+  int NumInlined = 0;
+  int NumRemoved = 0;
+  for (bool Changed = Budget > 0; Changed;) {
+    Changed = false;
+    // Only the calls of functions of the module, the ones in a removed
+    // callee are all of declarations.
+    SmallVector<CallInst *, 16> Calls;
+    for (auto &F : M) {
+      for (auto &I : instructions(F)) {
+        auto *CallI = dyn_cast<CallInst>(&I);
+        Function *Callee = CallI ? CallI->getCalledFunction() : nullptr;
+        if (Callee && Callee != &F && !Callee->isDeclaration()) {
+          Calls.push_back(CallI);
+        }
+      }
+    }
+    for (CallInst *CallI : Calls) {
+      Function *Callee = CallI->getCalledFunction();
+      LC3InlineCost Cost;
+      int CallSize = CallI->arg_size() + 2;
+      if (!GetCost(Callee, Cost) ||
+          Cost.Size - CallSize > Cost.CallOverhead + InlineSize ||
+          Cost.Size - CallSize > Budget) {
+        continue;
+      }
+      Function *Caller = CallI->getFunction();
+      InlineFunctionInfo IFI;
+      if (!InlineFunction(*CallI, IFI).isSuccess()) {
+        continue;
+      }
+      Budget -= Cost.Size - CallSize;
+      Costs.erase(Caller);
+      NumInlined++;
+      Changed = true;
+      if (Callee->use_empty() && Callee->hasLocalLinkage()) {
+        Budget += Cost.Size + Cost.CallOverhead;
+        Costs.erase(Callee);
+        Callee->eraseFromParent();
+        NumRemoved++;
+      }
+    }
+  }
+  if (NumInlined) {
+    errs() << "Inlined " << NumInlined << " calls, " << NumRemoved
+           << " functions removed, " << InlineBudget - Budget
+           << " words added\n";
+  }
+}
+
+// Emits the register copies in Copies (destination, source) as if they all
+// happened at once, breaking cycles through a register no copy writes and
+// that is not in Busy, the registers of the other values live there.
+// Returns the registers written.
+unsigned emitParallelCopies(SmallVectorImpl<std::pair<int, int>> &Copies,
+                            unsigned Busy, LC3Code &Code) {
+  unsigned Written = 0;
+  Copies.erase(remove_if(Copies,
+                         [](auto &Copy) { return Copy.first == Copy.second; }),
+               Copies.end());
+  for (auto &Copy : Copies) {
+    Written |= 1u << Copy.first;
+  }
+  while (!Copies.empty()) {
+    auto Ready = find_if(Copies, [&](auto &Copy) {
+      return none_of(Copies,
+                     [&](auto &Other) { return Other.second == Copy.first; });
+    });
+    if (Ready != Copies.end()) {
+      Code.emit("ADD", {regOp(Ready->first), regOp(Ready->second), immOp(0)});
+      Copies.erase(Ready);
+      continue;
+    }
+    // Only cycles are left, so every source is a destination as well.
+    int Temp = 0;
+    while (!(LC3AllocatableRegs & (1u << Temp)) ||
+           ((Written | Busy) & (1u << Temp))) {
+      Temp++;
+    }
+    int Src = Copies.front().second;
+    Code.emit("ADD", {regOp(Temp), regOp(Src), immOp(0)});
+    Written |= 1u << Temp;
+    for (auto &Copy : Copies) {
+      if (Copy.second == Src) {
+        Copy.second = Temp;
+      }
+    }
+  }
+  return Written;
+}
+
+// Emits LC3_DUMP_COUNTERS, which prints the NumCounters counters of
+// -lc3-instrument in hexadecimal, one per line, between two marker lines.
+// It saves every register it uses but R7, so that main can call it too.
+void emitDumpCounters(int NumCounters, LC3ConstantPool &Pool, LC3Code &Code,
+                      bool NoComment) {
+  if (!NoComment) {
+    Code.emitComment("\tprint the block counters");
+  }
+  Code.emitLabel("LC3_DUMP_COUNTERS");
+  Code.emit("ADD", {"R6", "R6", "#-7"});
+  for (int Reg : {0, 1, 2, 3, 4, 5, 7}) {
+    Code.emit("STR", {regOp(Reg), "R6", immOp(Reg == 7 ? 0 : 6 - Reg)});
+  }
+  auto EmitNewline = [&]() {
+    Code.emit("AND", {"R0", "R0", "#0"});
+    Code.emit("ADD", {"R0", "R0", "#10"});
+    Code.emit("OUT");
+  };
+  EmitNewline();
+  Code.emit("LEA", {"R0", Pool.addString("LC3 COUNTERS")});
+  Code.emit("PUTS");
+  EmitNewline();
+  Code.emit("LD", {"R1", Pool.addAddress("LC3_COUNTERS")});
+  Code.emit("LD", {"R2", Pool.addFill(NumCounters)});
+  Code.emitLabel("DUMP_WORD");
+  Code.emit("LDR", {"R3", "R1", "#0"});
+  Code.emit("AND", {"R5", "R5", "#0"});
+  Code.emit("ADD", {"R5", "R5", "#4"});
+  // Each digit is made of the four top bits of R3, shifted out one by one.
+  Code.emitLabel("DUMP_DIGIT");
+  Code.emit("AND", {"R0", "R0", "#0"});
+  Code.emit("AND", {"R4", "R4", "#0"});
+  Code.emit("ADD", {"R4", "R4", "#4"});
+  Code.emitLabel("DUMP_BIT");
+  Code.emit("ADD", {"R0", "R0", "R0"});
+  Code.emit("ADD", {"R3", "R3", "#0"});
+  Code.emitBranch("zp", "DUMP_ZERO");
+  Code.emit("ADD", {"R0", "R0", "#1"});
+  Code.emitLabel("DUMP_ZERO");
+  Code.emit("ADD", {"R3", "R3", "R3"});
+  Code.emit("ADD", {"R4", "R4", "#-1"});
+  Code.emitBranch("p", "DUMP_BIT");
+  Code.emit("ADD", {"R4", "R0", "#-10"});
+  Code.emitBranch("n", "DUMP_DECIMAL");
+  // From '0' + 10 to 'A'.
+  Code.emit("ADD", {"R0", "R0", "#7"});
+  Code.emitLabel("DUMP_DECIMAL");
+  Code.emit("LD", {"R4", Pool.addFill('0')});
+  Code.emit("ADD", {"R0", "R0", "R4"});
+  Code.emit("OUT");
+  Code.emit("ADD", {"R5", "R5", "#-1"});
+  Code.emitBranch("p", "DUMP_DIGIT");
+  EmitNewline();
+  Code.emit("ADD", {"R1", "R1", "#1"});
+  Code.emit("ADD", {"R2", "R2", "#-1"});
+  Code.emitBranch("p", "DUMP_WORD");
+  Code.emit("LEA", {"R0", Pool.addString("LC3 COUNTERS END")});
+  Code.emit("PUTS");
+  EmitNewline();
+  for (int Reg : {0, 1, 2, 3, 4, 5, 7}) {
+    Code.emit("LDR", {regOp(Reg), "R6", immOp(Reg == 7 ? 0 : 6 - Reg)});
+  }
+  Code.emit("ADD", {"R6", "R6", "#7"});
+  Code.emit("RET");
+  Code.emitBlank();
+}
+
+// Writes where each word of the program comes from, one line per word: its
+// address, then its function, basic block, source line and IR instruction,
+// separated by tabs. The ones not known are written as "-". BlockLabels maps
+// the labels of the basic blocks to their names.
+void writeMap(Module &M, ArrayRef<LC3MachineInst> Insts,
+              const StringMap<std::string> &BlockLabels,
+              const LC3Assembler &Assembler, raw_ostream &OS) {
+  ArrayRef<int> Lines = Assembler.getWordLines();
+  StringRef FuncName = "-";
+  StringRef BlockName = "-";
+  size_t Next = 0;
+  for (size_t Index = 0; Index < Lines.size(); Index++) {
+    auto &MI = Insts[Lines[Index] - 1];
+    for (; Next < (size_t)Lines[Index] - 1; Next++) {
+      if (Insts[Next].Kind != LC3MachineInst::Label) {
+        continue;
+      }
+      if (Function *F = M.getFunction(Insts[Next].Text);
+          F && !F->isDeclaration()) {
+        FuncName = F->getName();
+        BlockName = "-";
+      } else if (auto It = BlockLabels.find(Insts[Next].Text);
+                 It != BlockLabels.end()) {
+        BlockName = It->second;
+      }
+    }
+    std::string Line = "-";
+    std::string Text = "-";
+    if (const Instruction *I = MI.Source) {
+      if (const DebugLoc &Loc = I->getDebugLoc()) {
+        Line = (Loc->getFilename() + ":" + Twine(Loc.getLine())).str();
+      }
+      Text.clear();
+      raw_string_ostream TextStream(Text);
+      I->print(TextStream);
+      // Metadata attachments are left out, and the instructions printed on
+      // several lines, like switch, are put on one.
+      SmallVector<StringRef, 16> Words;
+      StringRef(Text).split(", !").first.split(Words, ' ', -1, false);
+      for (StringRef &Word : Words) {
+        Word = Word.trim();
+      }
+      Text = join(make_filter_range(Words, [](StringRef Word) {
+                    return !Word.empty();
+                  }),
+                  " ");
+    }
+    OS << format("x%04X", Assembler.getOrigin() + Index) << "\t" << FuncName
+       << "\t" << BlockName << "\t" << Line << "\t" << Text << "\n";
+  }
+}
+
+// Worst-case bounds of a function with its callees, std::nullopt when there
+// is none, StackReason or CycleReason saying why. They are computed from the
+// cycles of its blocks without the calls, the epilogue counted under null,
+// and from the words its frame takes on the stack.
+struct LC3Bounds {
+  DenseMap<const BasicBlock *, uint64_t> BlockCycles;
+  int FrameWords = 0;
+  std::optional<int> StackWords;
+  std::optional<uint64_t> Cycles;
+  std::string StackReason;
+  std::string CycleReason;
+};
+
+// Most times a loop of the code generated for an instruction runs, Label
+// being its first line. The shift loops step once per bit of the shift
+// amount, which is below the 32 bits of the IR type, the others once per bit
+// of a word.
+int getHelperLoopSteps(StringRef Label) {
+  return Label.startswith("SHL_LOOP_") || Label.startswith("LSHR_MASK_") ? 31
+                                                                         : 16;
+}
+
+// Adds the most cycles the lines of a function, Insts, take to the blocks
+// they belong to, from Entry on and from their labels in Labels. A branch
+// back to a label of the same block is a loop of the code generated for an
+// instruction, its lines count as many times as it may run.
+void addBlockCycles(ArrayRef<LC3MachineInst> Insts, const BasicBlock *Entry,
+                    const StringMap<const BasicBlock *> &Labels,
+                    DenseMap<const BasicBlock *, uint64_t> &BlockCycles) {
+  const BasicBlock *BB = Entry;
+  size_t Begin = 0;
+  auto AddBlock = [&](size_t End) {
+    std::vector<uint64_t> Steps(End - Begin, 1);
+    StringMap<size_t> LoopLabels;
+    // The label of the block itself is the target of a loop of the IR,
+    // bounded with the others.
+    for (size_t Index = Begin; Index < End; Index++) {
+      const LC3MachineInst &MI = Insts[Index];
+      if (MI.Kind == LC3MachineInst::Label && Index != Begin) {
+        LoopLabels[MI.Text] = Index;
+      } else if (MI.isBranch() && !MI.Operands.empty()) {
+        if (auto It = LoopLabels.find(MI.Operands[0]); It != LoopLabels.end()) {
+          for (size_t Pos = It->second; Pos <= Index; Pos++) {
+            Steps[Pos - Begin] *= getHelperLoopSteps(MI.Operands[0]);
+          }
+        }
+      }
+    }
+    uint64_t Cycles = 0;
+    for (size_t Index = Begin; Index < End; Index++) {
+      Cycles += Steps[Index - Begin] * Insts[Index].getCycles(MemCycles);
+    }
+    BlockCycles[BB] += Cycles;
+  };
+  for (size_t Index = 0; Index < Insts.size(); Index++) {
+    if (Insts[Index].Kind != LC3MachineInst::Label) {
+      continue;
+    }
+    if (auto It = Labels.find(Insts[Index].Text); It != Labels.end()) {
+      AddBlock(Index);
+      BB = It->second;
+      Begin = Index;
+    }
+  }
+  AddBlock(Insts.size());
+}
+
+// Records the bounds ScalarEvolution proves for the loops of F in
+// TripCounts, by their header. That is done before the canonicalization,
+// which negates the constants of the compares, and the analyses are dropped
+// after. The IR computes in 32 bits, the code in words: bounds past 16 bits
+// are not trusted.
+void recordTripCounts(Function &F, FunctionAnalysisManager &FAM,
+                      DenseMap<const BasicBlock *, unsigned> &TripCounts) {
+  ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+  for (Loop *L : FAM.getResult<LoopAnalysis>(F).getLoopsInPreorder()) {
+    if (unsigned Trips = SE.getSmallConstantMaxTripCount(L);
+        Trips && Trips <= 0xFFFF) {
+      TripCounts[L->getHeader()] = Trips;
+    }
+  }
+  FAM.invalidate(F, PreservedAnalyses::none());
+}
+
+std::optional<uint64_t>
+getLoopCycles(Loop *L, LoopInfo &LI,
+              const DenseMap<const BasicBlock *, unsigned> &TripCounts,
+              const DenseMap<const BasicBlock *, uint64_t> &BlockCycles,
+              std::string &Reason);
+
+// Returns the most cycles a path from BB takes through the blocks of the
+// loop L, or of the function when L is null, up to a back edge or an exit.
+// The loops nested in it count as one block. Memo keeps the results of the
+// blocks visited, std::nullopt when they have no bound, which Reason
+// explains.
+std::optional<uint64_t>
+getPathCycles(BasicBlock *BB, Loop *L, LoopInfo &LI,
+              const DenseMap<const BasicBlock *, unsigned> &TripCounts,
+              const DenseMap<const BasicBlock *, uint64_t> &BlockCycles,
+              DenseMap<BasicBlock *, std::optional<uint64_t>> &Memo,
+              std::string &Reason) {
+  if (auto It = Memo.find(BB); It != Memo.end()) {
+    // Still on the path, in a cycle that is not a loop.
+    if (!It->second && Reason.empty()) {
+      Reason = "irreducible loop at " + getBBName(BB);
+    }
+    return It->second;
+  }
+  Memo[BB] = std::nullopt;
+  std::optional<uint64_t> Cycles;
+  SmallVector<BasicBlock *, 8> Succs;
+  if (Loop *Inner = LI.getLoopFor(BB); Inner != L) {
+    while (Inner->getParentLoop() != L) {
+      Inner = Inner->getParentLoop();
+    }
+    Cycles = getLoopCycles(Inner, LI, TripCounts, BlockCycles, Reason);
+    Inner->getExitBlocks(Succs);
+  } else {
+    Cycles = BlockCycles.lookup(BB);
+    append_range(Succs, successors(BB));
+  }
+  uint64_t Longest = 0;
+  for (BasicBlock *Succ : Succs) {
+    if (!Cycles) {
+      break;
+    }
+    if (L && (!L->contains(Succ) || Succ == L->getHeader())) {
+      continue;
+    }
+    if (auto Path = getPathCycles(Succ, L, LI, TripCounts, BlockCycles, Memo,
+                                  Reason)) {
+      Longest = std::max(Longest, *Path);
     } else {
-      BufferStream << ";\tR7: save the current label\n";
+      Cycles = std::nullopt;
     }
-  } else if (auto *PHIN = dyn_cast<PHINode>(&I)) {
-    BufferStream << ";\tR0: -from label\n"
-                 << ";\tR1: cond label, result\n";
   }
-  return BufferStream.str();
+  if (Cycles) {
+    Cycles = SaturatingAdd(*Cycles, Longest);
+  }
+  Memo[BB] = Cycles;
+  return Cycles;
+}
+
+// Returns the most cycles the loop L takes, its bound in TripCounts times
+// the most cycles of an iteration.
+std::optional<uint64_t>
+getLoopCycles(Loop *L, LoopInfo &LI,
+              const DenseMap<const BasicBlock *, unsigned> &TripCounts,
+              const DenseMap<const BasicBlock *, uint64_t> &BlockCycles,
+              std::string &Reason) {
+  unsigned Trips = TripCounts.lookup(L->getHeader());
+  if (!Trips) {
+    if (Reason.empty()) {
+      Reason = "no bound for the loop at " + getBBName(L->getHeader());
+    }
+    return std::nullopt;
+  }
+  DenseMap<BasicBlock *, std::optional<uint64_t>> Memo;
+  auto Iteration =
+      getPathCycles(L->getHeader(), L, LI, TripCounts, BlockCycles, Memo,
+                    Reason);
+  if (!Iteration) {
+    return std::nullopt;
+  }
+  return SaturatingMultiply<uint64_t>(Trips, *Iteration);
+}
+
+// Computes the bounds of the functions in FuncBounds from the ones of their
+// callees, going up the strongly connected components of the call graph.
+// The functions in a cycle of calls have none, but a function calling itself
+// from tail calls only reuses its frame. Calls after the epilogue run on the
+// stack of the caller of the function.
+void computeBounds(CallGraph &CG, FunctionAnalysisManager &FAM,
+                   const DenseSet<Function *> &StaticFuncs,
+                   const DenseMap<const BasicBlock *, unsigned> &TripCounts,
+                   DenseMap<Function *, LC3Bounds> &FuncBounds) {
+  for (auto SCCI = scc_begin(&CG); !SCCI.isAtEnd(); ++SCCI) {
+    for (CallGraphNode *Node : *SCCI) {
+      Function *F = Node->getFunction();
+      auto It = F ? FuncBounds.find(F) : FuncBounds.end();
+      if (It == FuncBounds.end()) {
+        continue;
+      }
+      LC3Bounds &Bounds = It->second;
+      if (SCCI->size() > 1) {
+        Bounds.StackReason = "recursive";
+      }
+      if (SCCI.hasCycle()) {
+        Bounds.CycleReason = "recursive";
+      }
+      DenseMap<const BasicBlock *, uint64_t> BlockCycles = Bounds.BlockCycles;
+      int CallWords = 0;
+      int TailCallWords = 0;
+      for (auto &I : instructions(*F)) {
+        auto *CallI = dyn_cast<CallInst>(&I);
+        Function *Callee = CallI ? CallI->getCalledFunction() : nullptr;
+        if (!Callee) {
+          continue;
+        }
+        // The routine printing the counters saves 7 registers, the time it
+        // takes grows with the program.
+        if (Instrument && Callee->getName() == "dumpLC3Counters") {
+          CallWords = std::max(CallWords, 7);
+          if (Bounds.CycleReason.empty()) {
+            Bounds.CycleReason = "calls dumpLC3Counters";
+          }
+          continue;
+        }
+        auto CalleeIt = FuncBounds.find(Callee);
+        if (CalleeIt == FuncBounds.end()) {
+          continue;
+        }
+        bool IsTailCall = getTailCallee(CallI, StaticFuncs);
+        if (Callee == F) {
+          if (!IsTailCall) {
+            Bounds.StackReason = "recursive";
+          }
+          continue;
+        }
+        LC3Bounds &CalleeBounds = CalleeIt->second;
+        if (!CalleeBounds.StackWords) {
+          if (Bounds.StackReason.empty()) {
+            Bounds.StackReason = ("calls " + Callee->getName()).str();
+          }
+        } else {
+          int &Words = IsTailCall ? TailCallWords : CallWords;
+          Words = std::max(Words, *CalleeBounds.StackWords);
+        }
+        if (!CalleeBounds.Cycles) {
+          if (Bounds.CycleReason.empty()) {
+            Bounds.CycleReason = ("calls " + Callee->getName()).str();
+          }
+        } else {
+          uint64_t &Cycles = BlockCycles[I.getParent()];
+          Cycles = SaturatingAdd(Cycles, *CalleeBounds.Cycles);
+        }
+      }
+      if (Bounds.StackReason.empty()) {
+        Bounds.StackWords =
+            std::max(Bounds.FrameWords + CallWords, TailCallWords);
+      }
+      if (!Bounds.CycleReason.empty()) {
+        continue;
+      }
+
+      // The epilogue runs after every return but the tail calls.
+      uint64_t EpilogueCycles = BlockCycles.lookup(nullptr);
+      for (auto &BB : *F) {
+        auto *RetI = dyn_cast<ReturnInst>(BB.getTerminator());
+        auto *CallI = dyn_cast_or_null<CallInst>(RetI ? RetI->getPrevNode()
+                                                      : nullptr);
+        if (RetI && !(CallI && getTailCallee(CallI, StaticFuncs))) {
+          BlockCycles[&BB] += EpilogueCycles;
+        }
+      }
+      DenseMap<BasicBlock *, std::optional<uint64_t>> Memo;
+      Bounds.Cycles = getPathCycles(
+          &F->getEntryBlock(), nullptr, FAM.getResult<LoopAnalysis>(*F),
+          TripCounts, BlockCycles, Memo, Bounds.CycleReason);
+    }
+  }
+}
+
+// Writes the bounds of the functions of M, in the order of the module.
+void writeBounds(Module &M, const DenseMap<Function *, LC3Bounds> &FuncBounds,
+                 raw_ostream &OS) {
+  OS << "Worst-case bounds with the callees, memory accesses of " << MemCycles
+     << " cycles\n"
+     << "   frame    stack       cycles  function\n";
+  for (auto &F : M) {
+    auto It = FuncBounds.find(&F);
+    if (It == FuncBounds.end()) {
+      continue;
+    }
+    const LC3Bounds &Bounds = It->second;
+    std::string Stack =
+        Bounds.StackWords ? std::to_string(*Bounds.StackWords) : "-";
+    std::string Cycles = Bounds.Cycles ? std::to_string(*Bounds.Cycles) : "-";
+    OS << right_justify(std::to_string(Bounds.FrameWords), 8) << " "
+       << right_justify(Stack, 8) << " " << right_justify(Cycles, 12) << "  "
+       << F.getName();
+    SmallVector<std::string, 2> Reasons;
+    if (!Bounds.StackReason.empty()) {
+      Reasons.push_back("stack: " + Bounds.StackReason);
+    }
+    if (!Bounds.CycleReason.empty()) {
+      Reasons.push_back("cycles: " + Bounds.CycleReason);
+    }
+    if (!Reasons.empty()) {
+      OS << " (" << join(Reasons, ", ") << ")";
+    }
+    OS << "\n";
+  }
 }
 
 PreservedAnalyses LLVMIRToLC3Pass::run(Module &M, ModuleAnalysisManager &MAM) {
@@ -195,547 +1518,1098 @@ PreservedAnalyses LLVMIRToLC3Pass::run(Module &M, ModuleAnalysisManager &MAM) {
 
   std::error_code EC;
   ToolOutputFile Out(TargetFileName, EC, sys::fs::OF_None);
-  std::string InstBuffer;
-  raw_string_ostream InstBufferStream(InstBuffer);
 
   if (EC) {
     errs() << "Error: " << EC.message() << "\n";
     return PreservedAnalyses::none();
   }
+  // The code of the whole program, printed to the .asm file and assembled
+  // from the same lines.
+  LC3Code Program;
   if (!NoComment) {
-    Out.os() << ";\tThis file is generated automatically by ir-to-lc3 pass.\n"
-             << "\n"
-             << ";\tR6 : stack pointer\n"
-             << ";\tR5 : frame pointer\n"
-             << "\n";
+    Program.emitComment("\tThis file is generated automatically by ir-to-lc3 "
+                       "pass.");
+    Program.emitBlank();
+    Program.emitComment("\tR6 : stack pointer");
+    Program.emitComment("\tR5 : frame pointer");
+    Program.emitBlank();
   }
-  Out.os() << "\t.ORIG\t" << LC3StartAddrArg << "\n";
+  Program.emit(".ORIG", {LC3StartAddrArg.getValue()});
+
+  FunctionAnalysisManager &FAM =
+      MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
 
   DenseMap<Value *, std::string> BBNameMap;
   DenseMap<Function *, std::string> FuncLabelMap;
   int BBNameCounter = 0;
-  int ImmIDCounter = 0;
   int TempLabelCounter = 0;
 
+  // main may be far from the start, its address is loaded from the word
+  // after the stack base.
+  bool HasMain = false;
+  if (Function *Main = M.getFunction("main")) {
+    HasMain = !Main->isDeclaration();
+  }
+  // With -lc3-instrument, main returns to the header, which prints the
+  // counters then halts, its result left in R0.
+  if (HasMain) {
+    Program.emit("LD", {"R6", "STACK_BASE"});
+    Program.emit("LD", {"R0", "MAIN_ADDR"});
+    if (Instrument) {
+      Program.emit("JSRR", {"R0"});
+      Program.emit("LD", {"R1", "DUMP_ADDR"});
+      Program.emit("JSRR", {"R1"});
+      Program.emit("HALT");
+    } else {
+      Program.emit("JMP", {"R0"});
+    }
+    Program.emitBlank();
+    Program.emitLabel("STACK_BASE");
+    Program.emit(".FILL", {LC3StackBaseArg.getValue()});
+    Program.emitLabel("MAIN_ADDR");
+    Program.emit(".FILL", {"main"});
+    if (Instrument) {
+      Program.emitLabel("DUMP_ADDR");
+      Program.emit(".FILL", {"LC3_DUMP_COUNTERS"});
+    }
+    Program.emitBlank();
+  }
+  LC3ConstantPool Pool(HasMain ? (Instrument ? 9 : 5) : 0);
+  LC3Peephole Peephole;
+  // Function, label and name of the block each counter belongs to.
+  std::vector<std::tuple<std::string, std::string, std::string>> Counters;
+
+  StringMap<uint64_t> BlockCounts;
+  if (!ProfileFileName.empty() &&
+      !readBlockCounts(ProfileFileName, BlockCounts)) {
+    return PreservedAnalyses::none();
+  }
+
+  inlineSmallFunctions(M);
+  // With -lc3-bounds, the most times each loop may run, by its header.
+  DenseMap<const BasicBlock *, unsigned> TripCounts;
+  for (auto &F : M) {
+    if (F.isIntrinsic() || F.isDeclaration()) {
+      continue;
+    }
+    if (EmitBounds) {
+      recordTripCounts(F, FAM, TripCounts);
+    }
+    if (Instruction *I = canonicalizeFunction(F)) {
+      return UnsupportInst(*I);
+    }
+    // The blocks are named as in the run profiled, which went through the
+    // same changes.
+    applyBlockCounts(F, BlockCounts);
+  }
+
+  // Functions that are not recursive are never active twice at a time, with
+  // -lc3-static-frames they may get a frame at a fixed address instead of
+  // one on the stack. Calling themselves from a tail call does not count,
+  // that reuses the frame. The strongly connected components of the call
+  // graph are kept from the callers to the callees to overlay the frames.
+  CallGraph &CG = MAM.getResult<CallGraphAnalysis>(M);
+  std::vector<std::vector<CallGraphNode *>> SCCs;
+  DenseSet<Function *> StaticFuncs;
+  if (StaticFrames) {
+    for (auto SCCI = scc_begin(&CG); !SCCI.isAtEnd(); ++SCCI) {
+      SCCs.push_back(*SCCI);
+      Function *F = SCCs.back().front()->getFunction();
+      if (SCCs.back().size() > 1 || !F || F->isDeclaration()) {
+        continue;
+      }
+      bool IsRecursive = any_of(instructions(*F), [&](Instruction &I) {
+        auto *CallI = dyn_cast<CallInst>(&I);
+        return CallI && CallI->getCalledFunction() == F &&
+               !getTailCallee(CallI, StaticFuncs);
+      });
+      if (!IsRecursive) {
+        StaticFuncs.insert(F);
+      }
+    }
+    std::reverse(SCCs.begin(), SCCs.end());
+  }
+  // Words of the static frames below and above their R5, which is the label
+  // GetFrameLabel gives.
+  DenseMap<Function *, std::pair<int, int>> StaticFrameWords;
+  auto GetFrameLabel = [](Function *F) {
+    return "FRAME_" + F->getName().str();
+  };
+  // With -lc3-bounds, what the worst-case bounds of each function are
+  // computed from.
+  DenseMap<Function *, LC3Bounds> FuncBounds;
+
   for (auto &F : M) {
     if (F.isIntrinsic() || F.isDeclaration()) {
       continue;
     }
 
     StringRef FuncName = F.getName();
-    std::string FuncInstBuffer;
-    raw_string_ostream FuncInstBufferStream(FuncInstBuffer);
+    LC3Code Body;
 
     DenseMap<Value *, int> ValueOffsetMap;
     int ValueOffsetCounter = 0;
 
-    bool isFirstBB = true;
+    DenseMap<Instruction *, unsigned> ClobberMap;
+    // Pointers are frame slots themselves, the strings passed to printStr
+    // are addressed through their slot as well.
+    DenseSet<Value *> MemoryValues;
     for (auto &BB : F) {
+      for (auto &I : BB) {
+        if (unsigned Clobbers = getClobberedRegs(I, StaticFuncs)) {
+          ClobberMap[&I] = Clobbers;
+        }
+        if (auto *LoadI = dyn_cast<LoadInst>(&I)) {
+          MemoryValues.insert(LoadI->getPointerOperand());
+        } else if (auto *StoreI = dyn_cast<StoreInst>(&I)) {
+          MemoryValues.insert(StoreI->getPointerOperand());
+        } else if (auto *CallI = dyn_cast<CallInst>(&I)) {
+          Function *Func = CallI->getCalledFunction();
+          if (Func && Func->getName() == "printStr" &&
+              CallI->arg_size() == 1) {
+            MemoryValues.insert(CallI->getArgOperand(0));
+          }
+        }
+      }
+    }
+
+    // Compares branched on right away are never computed, neither are the
+    // results of tail calls.
+    DenseSet<Value *> FoldedValues;
+    for (auto &I : instructions(F)) {
+      if (auto *ICmpI = dyn_cast<ICmpInst>(&I);
+          ICmpI && getFusedBranch(ICmpI)) {
+        FoldedValues.insert(ICmpI);
+      } else if (auto *CallI = dyn_cast<CallInst>(&I);
+                 CallI && getTailCallee(CallI, StaticFuncs)) {
+        FoldedValues.insert(CallI);
+      }
+    }
+
+    // With a profile, from !prof metadata or -lc3-profile, the frequencies
+    // of the blocks are measured rather than guessed from the loops.
+    LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+    BlockFrequencyInfo &BFI = FAM.getResult<BlockFrequencyAnalysis>(F);
+    bool HasProfile = F.hasProfileData();
+    LC3RegAlloc RegAlloc(F, LI, ClobberMap, MemoryValues, FoldedValues,
+                         HasProfile ? &BFI : nullptr);
+    RegAlloc.run();
+
+    // The objects kept in the frame: the spill slots, shared between values
+    // that are never live at the same time, then the allocas and the other
+    // memory values with a slot of their own.
+    std::vector<SmallVector<Value *, 2>> FrameObjects(RegAlloc.getNumSlots());
+    std::vector<float> FrameFrequency(RegAlloc.getNumSlots());
+    for (auto &Interval : RegAlloc.getIntervals()) {
+      if (Interval.Slot >= 0) {
+        FrameObjects[Interval.Slot].push_back(Interval.Val);
+        FrameFrequency[Interval.Slot] += Interval.Frequency;
+      }
+    }
+    auto AddMemoryObject = [&](Value *Val) {
+      if (Val->use_empty() ||
+          (!isa<AllocaInst>(Val) && !MemoryValues.count(Val))) {
+        return;
+      }
+      float Frequency = 0;
+      for (User *U : Val->users()) {
+        Frequency += RegAlloc.getFrequency(cast<Instruction>(U)->getParent());
+      }
+      FrameObjects.push_back({Val});
+      FrameFrequency.push_back(Frequency);
+    };
+    for (auto &Arg : F.args()) {
+      AddMemoryObject(&Arg);
+    }
+    for (auto &I : instructions(F)) {
+      AddMemoryObject(&I);
+    }
+
+    // Frame slots used to borrow a register when an instruction needs more
+    // scratch registers than are free at that point.
+    SmallVector<int, 6> ScavengeSlots;
+
+    // Registers the function writes, the prologue saves the ones the callers
+    // expect to be preserved.
+    unsigned WrittenRegs = 0;
+    for (auto &Interval : RegAlloc.getIntervals()) {
+      if (Interval.Reg >= 0) {
+        WrittenRegs |= 1u << Interval.Reg;
+      }
+    }
+    for (auto &Clobber : ClobberMap) {
+      WrittenRegs |= Clobber.second;
+    }
+
+    // Small frames are addressed from R5 and get their scavenge slots when
+    // they are needed. Larger ones are laid out once, with R6 as a second
+    // base: the most frequently accessed objects go to the slots LDR and STR
+    // reach directly, the others cost an extra ADD for every 16 words they
+    // are away. One scavenge slot is reserved per register that could be
+    // borrowed, in the direct slots as the borrowed register can not be
+    // used for addressing.
+    int NumObjects = FrameObjects.size();
+    int FrameSize = 0;
+    SmallVector<int, 32> Positions;
+    for (int Slot = 1; Slot <= NumObjects; Slot++) {
+      Positions.push_back(Slot);
+    }
+    std::vector<int> Order(NumObjects);
+    for (int ID = 0; ID < NumObjects; ID++) {
+      Order[ID] = ID;
+    }
+    if (NumObjects + 6 > 32) {
+      FrameSize = NumObjects + 6;
+      for (int Slot = NumObjects + 1; Slot <= FrameSize; Slot++) {
+        Positions.push_back(Slot);
+      }
+      std::stable_sort(Positions.begin(), Positions.end(), [&](int A, int B) {
+        return getFrameAccessCost(A, FrameSize) <
+               getFrameAccessCost(B, FrameSize);
+      });
+      auto Direct = find_if(Positions, [&](int Slot) {
+        return getFrameAccessCost(Slot, FrameSize);
+      });
+      ScavengeSlots.append(Direct - 6, Direct);
+      Positions.erase(Direct - 6, Direct);
+      std::stable_sort(Order.begin(), Order.end(), [&](int A, int B) {
+        return FrameFrequency[A] > FrameFrequency[B];
+      });
+    }
+    for (int ID = 0; ID < NumObjects; ID++) {
+      for (Value *Val : FrameObjects[Order[ID]]) {
+        ValueOffsetMap[Val] = Positions[ID];
+      }
+    }
+    ValueOffsetCounter = FrameSize ? FrameSize : NumObjects;
+
+    // Static frames are addressed from R5 only, large frames stay on the
+    // stack.
+    bool IsStatic = StaticFuncs.count(&F) && !FrameSize;
+    bool CallsStaticFrame = false;
+
+    std::vector<BasicBlock *> Layout =
+        layoutBlocks(F, BFI, FAM.getResult<BranchProbabilityAnalysis>(F));
+
+    // The epilogue is placed once, after the most frequent return, the other
+    // ones branch to it. Tail calls of the function itself branch back to
+    // the code storing the arguments.
+    ReturnInst *EpilogueRet = nullptr;
+    for (BasicBlock *BB : Layout) {
+      auto *RetI = dyn_cast<ReturnInst>(BB->getTerminator());
+      auto *CallI = dyn_cast_or_null<CallInst>(RetI ? RetI->getPrevNode()
+                                                    : nullptr);
+      if (!RetI || (CallI && getTailCallee(CallI, StaticFuncs))) {
+        continue;
+      }
+      if (!EpilogueRet || RegAlloc.getFrequency(BB) >
+                              RegAlloc.getFrequency(EpilogueRet->getParent())) {
+        EpilogueRet = RetI;
+      }
+    }
+    std::string EpilogueLabel = "EPILOGUE_" + std::to_string(++TempLabelCounter);
+    std::string TailCallLabel;
+
+    bool isFirstBB = true;
+    for (size_t Pos = 0; Pos < Layout.size(); Pos++) {
+      BasicBlock &BB = *Layout[Pos];
       std::string BBName = getIndex(&BB, BBNameMap, BBNameCounter);
 
       if (isFirstBB) {
-        if (FuncName == "main") {
-          Out.os() << "\tLD\t\tR6, STACK_BASE\n"
-                   << "\tBR\t\t" << BBName << "\n"
-                   << "\n"
-                   << "STACK_BASE\n\t.FILL\t" << LC3StackBaseArg << "\n"
-                   << "\n";
-        }
         FuncLabelMap[&F] = BBName;
         isFirstBB = false;
       } else {
-        FuncInstBufferStream << BBName << "\n";
+        Body.emitLabel(BBName);
       }
 
-      DenseMap<Value *, bool> ImmFlag;
-      DenseMap<Value *, int> ImmIDMap;
-      std::string ImmBuffer;
-      raw_string_ostream ImmBufferStream(ImmBuffer);
+      Pool.startBlock();
+
+      // Nothing lives below the stack, R0 is kept there meanwhile.
+      if (Instrument) {
+        std::string Counter = Pool.addAddress("COUNT_" + BBName);
+        Body.emit("STR", {"R0", "R6", "#-1"});
+        Body.emit("LDI", {"R0", Counter});
+        Body.emit("ADD", {"R0", "R0", "#1"});
+        Body.emit("STI", {"R0", Counter});
+        Body.emit("LDR", {"R0", "R6", "#-1"});
+        Counters.push_back({FuncName.str(), BBName, getBBName(&BB)});
+      }
 
       LLVMContext &Ctx = F.getContext();
       Type *WordTy = Type::getInt32Ty(Ctx);
 
-      for (auto &I : make_early_inc_range(BB)) {
-        if (auto *IntrI = dyn_cast<IntrinsicInst>(&I)) {
-          CmpInst::Predicate Pred;
-          switch (IntrI->getIntrinsicID()) {
-          case Intrinsic::smin:
-            Pred = CmpInst::ICMP_SLT;
-            break;
-          case Intrinsic::smax:
-            Pred = CmpInst::ICMP_SGT;
-            break;
-          case Intrinsic::umin:
-            Pred = CmpInst::ICMP_ULT;
-            break;
-          case Intrinsic::umax:
-            Pred = CmpInst::ICMP_UGT;
-            break;
-          case Intrinsic::lifetime_start:
-            continue;
-          case Intrinsic::lifetime_end:
-            continue;
-          default:
-            return UnsupportInst(I);
+      // Registers free for the instruction being lowered, and the ones it
+      // can not borrow because its operands or result are kept there.
+      unsigned ScratchRegs = 0;
+      unsigned ReservedRegs = 0;
+      unsigned HandedRegs = 0;
+      SmallVector<std::pair<int, int>, 6> ScavengedRegs;
+
+      auto GetScratch = [&]() -> int {
+        for (int Reg : {1, 2, 3, 4, 0, 7}) {
+          if (ScratchRegs & (1u << Reg)) {
+            ScratchRegs &= ~(1u << Reg);
+            ReservedRegs |= 1u << Reg;
+            HandedRegs |= 1u << Reg;
+            WrittenRegs |= 1u << Reg;
+            return Reg;
           }
-
-          IRBuilder<> Builder(IntrI);
-          Value *A = IntrI->getArgOperand(0);
-          Value *B = IntrI->getArgOperand(1);
-
-          Value *Cmp = Builder.CreateICmp(Pred, A, B);
-          Value *Select = Builder.CreateSelect(Cmp, A, B);
-
-          IntrI->replaceAllUsesWith(Select);
-          IntrI->eraseFromParent();
         }
-      }
-
-      for (auto &I : make_early_inc_range(BB)) {
-        if (auto *ICmpI = dyn_cast<ICmpInst>(&I)) {
-          Value *FirVal = ICmpI->getOperand(0);
-          if (auto *ConstInt = dyn_cast<ConstantInt>(FirVal)) {
-            ICmpI->swapOperands();
+        for (int Reg : {1, 2, 3, 4, 0, 7}) {
+          if (!(ReservedRegs & (1u << Reg))) {
+            if (ScavengedRegs.size() == ScavengeSlots.size()) {
+              ScavengeSlots.push_back(++ValueOffsetCounter);
+            }
+            int Slot = ScavengeSlots[ScavengedRegs.size()];
+            emitFrameAccess("STR", Reg, Slot, FrameSize, Reg,
+                            Body);
+            ScavengedRegs.push_back({Reg, Slot});
+            ReservedRegs |= 1u << Reg;
+            HandedRegs |= 1u << Reg;
+            return Reg;
           }
-          auto Pred = ICmpI->getPredicate();
-          Value *A = ICmpI->getOperand(0);
-          Value *B = ICmpI->getOperand(1);
-          if (auto *ConstInt = dyn_cast<ConstantInt>(B)) {
-            IRBuilder<> Builder(ICmpI);
-
-            auto *NegativeConst =
-                ConstantInt::get(WordTy, -ConstInt->getSExtValue());
-            auto *II = Builder.CreateICmp(Pred, A, NegativeConst);
-
-            I.replaceAllUsesWith(II);
-            I.eraseFromParent();
+        }
+        llvm_unreachable("no register left to borrow");
+      };
+      auto RestoreScavenged = [&]() {
+        for (auto &Scavenged : reverse(ScavengedRegs)) {
+          emitFrameAccess("LDR", Scavenged.first, Scavenged.second, FrameSize,
+                          Scavenged.first, Body);
+        }
+      };
+
+      // Copies Val into Reg, from an immediate, the constant section, its
+      // register or its frame slot.
+      auto LoadReg = [&](Value *Val, int Reg) {
+        if (int Imm; getImm5(Val, Imm)) {
+          Body.emit("AND", {regOp(Reg), regOp(Reg), immOp(0)});
+          if (Imm) {
+            Body.emit("ADD", {regOp(Reg), regOp(Reg), immOp(Imm)});
           }
-        } else if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
-          auto OpCode = BinOp->getOpcode();
-          Value *A = BinOp->getOperand(0);
-          Value *B = BinOp->getOperand(1);
-          switch (OpCode) {
-          case Instruction::Sub:
-            if (auto *ConstInt = dyn_cast<ConstantInt>(B)) {
-              IRBuilder<> Builder(BinOp);
-
-              auto *NegativeConst =
-                  ConstantInt::get(WordTy, -ConstInt->getSExtValue());
-              auto *BI = Builder.CreateAdd(A, NegativeConst);
-
-              I.replaceAllUsesWith(BI);
-              I.eraseFromParent();
-            }
-            break;
-          default:
-            continue;
+        } else if (std::string Ref = addImmidiate(Val, Pool); !Ref.empty()) {
+          Body.emit("LD", {regOp(Reg), Ref});
+        } else if (std::string Ref = addString(Val, Pool); !Ref.empty()) {
+          Body.emit("LEA", {regOp(Reg), Ref});
+        } else if (int Home = RegAlloc.getReg(Val); Home >= 0) {
+          if (Home != Reg) {
+            Body.emit("ADD", {regOp(Reg), regOp(Home), immOp(0)});
           }
+        } else {
+          int ValSlot = getIndex(Val, ValueOffsetMap, ValueOffsetCounter);
+          emitFrameAccess("LDR", Reg, ValSlot, FrameSize, Reg,
+                          Body);
         }
-      }
-
-      for (auto &I : make_early_inc_range(BB)) {
-        if (auto *BrI = dyn_cast<BranchInst>(&I)) {
-          if (BrI->isConditional()) {
-            Value *Cond = BrI->getCondition();
-
-            if (auto *ICmpI = dyn_cast<ICmpInst>(Cond)) {
-              auto Pred = ICmpI->getPredicate();
-              if (Pred == CmpInst::ICMP_EQ || Pred == CmpInst::ICMP_NE) {
-                Value *Val = ICmpI->getOperand(0);
-                Value *ConVal = ICmpI->getOperand(1);
-                if (auto *ConstInt = dyn_cast<ConstantInt>(ConVal)) {
-                  IRBuilder<> Builder(BrI);
-                  auto *Zero =
-                      ConstantInt::get(WordTy, ConstInt->getSExtValue());
-                  SwitchInst *SI = Builder.CreateSwitch(
-                      Val, BrI->getSuccessor(Pred == CmpInst::ICMP_EQ), 1);
-                  SI->addCase(cast<ConstantInt>(Zero),
-                              BrI->getSuccessor(Pred == CmpInst::ICMP_NE));
-
-                  BrI->eraseFromParent();
-                  if (ICmpI->use_empty())
-                    ICmpI->eraseFromParent();
-                }
-              }
+      };
+      // Returns the register holding Val, loading it into a scratch register
+      // if it is not kept in one.
+      auto UseReg = [&](Value *Val) -> int {
+        int Reg = RegAlloc.getReg(Val);
+        if (Reg < 0) {
+          Reg = GetScratch();
+          LoadReg(Val, Reg);
+        }
+        return Reg;
+      };
+      // Like UseReg, but also sets the condition codes from Val.
+      auto TestReg = [&](Value *Val) -> int {
+        int Reg = RegAlloc.getReg(Val);
+        if (Reg >= 0) {
+          Body.emit("ADD", {regOp(Reg), regOp(Reg), immOp(0)});
+          return Reg;
+        }
+        return UseReg(Val);
+      };
+      // Returns a register Reg's value can be overwritten in.
+      auto TempReg = [&](int Reg) {
+        return (HandedRegs & (1u << Reg)) ? Reg : GetScratch();
+      };
+      // Returns the register the result Val should be computed in. The
+      // lowerings write it last, so a scratch register holding an operand
+      // can be reused.
+      auto DefReg = [&](Value *Val) -> int {
+        int Reg = RegAlloc.getReg(Val);
+        if (Reg >= 0) {
+          return Reg;
+        }
+        for (Reg = 0; Reg < 8; Reg++) {
+          if (HandedRegs & (1u << Reg)) {
+            return Reg;
+          }
+        }
+        return GetScratch();
+      };
+      // Writes the result of Val computed in Reg back to its home.
+      auto StoreReg = [&](Value *Val, int Reg) {
+        if (Val->use_empty()) {
+          return;
+        }
+        int Home = RegAlloc.getReg(Val);
+        if (Home < 0) {
+          int ResSlot = getIndex(Val, ValueOffsetMap, ValueOffsetCounter);
+          int AddrReg =
+              getFrameAccessCost(ResSlot, FrameSize) ? GetScratch() : Reg;
+          emitFrameAccess("STR", Reg, ResSlot, FrameSize, AddrReg,
+                          Body);
+        } else if (Home != Reg) {
+          Body.emit("ADD", {regOp(Home), regOp(Reg), immOp(0)});
+        }
+      };
+
+      // Writes the incoming values from BB into the PHIs of Succ, as one
+      // parallel copy: every value is read before any PHI is written. The
+      // locations are the registers, then the frame slots from 8 on.
+      auto EmitPHICopies = [&](BasicBlock *Succ) {
+        // The copies are generated for the PHIs.
+        const Instruction *Source = Body.getSource();
+        Body.setSource(&Succ->front());
+        struct LC3PHICopy {
+          int Dst;
+          // -1 for constants
+          int Src;
+          Value *Val;
+        };
+        auto GetLoc = [&](Value *Val) {
+          if (int Reg = RegAlloc.getReg(Val); Reg >= 0) {
+            return Reg;
+          }
+          return 8 + getIndex(Val, ValueOffsetMap, ValueOffsetCounter);
+        };
+        SmallVector<LC3PHICopy, 8> Copies;
+        for (auto &PHIN : Succ->phis()) {
+          Value *Val = PHIN.getIncomingValueForBlock(&BB);
+          if (PHIN.use_empty() || isa<UndefValue>(Val)) {
+            continue;
+          }
+          int Dst = GetLoc(&PHIN);
+          int Src = isa<Constant>(Val) ? -1 : GetLoc(Val);
+          for (int Loc : {Dst, Src}) {
+            if (Loc >= 0 && Loc < 8) {
+              ReservedRegs |= 1u << Loc;
             }
           }
-        } else if (auto *TruncI = dyn_cast<TruncInst>(&I)) {
-          Value *Source = TruncI->getOperand(0);
-
-          TruncI->replaceAllUsesWith(Source);
-          TruncI->eraseFromParent();
-        } else if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
-          auto OpCode = BinOp->getOpcode();
-          Value *A = I.getOperand(0);
-          Value *B = I.getOperand(1);
-          switch (OpCode) {
-          case Instruction::LShr:
-            if (auto *ShiftAmt = dyn_cast<ConstantInt>(B)) {
-              unsigned BitWidth = A->getType()->getIntegerBitWidth();
-              uint64_t ShiftVal = ShiftAmt->getZExtValue();
-
-              if (ShiftVal >= BitWidth) {
-                continue;
-              }
-
-              APInt DivisorVal = APInt(BitWidth, 1).shl(ShiftVal);
-              Constant *Divisor = ConstantInt::get(I.getContext(), DivisorVal);
+          if (Dst != Src) {
+            Copies.push_back({Dst, Src, Val});
+          }
+        }
 
-              IRBuilder<> Builder(&I);
-              Value *DivInst = Builder.CreateUDiv(A, Divisor);
-              I.replaceAllUsesWith(DivInst);
-              I.eraseFromParent();
+        // Values going from memory to memory pass through ValReg, a value
+        // of a cycle of copies is kept in CycleReg while its location is
+        // written.
+        int ValReg = -1;
+        int AddrReg = -1;
+        int CycleReg = -1;
+        auto EmitLoad = [&](int Reg, int Src, Value *Val) {
+          if (Src < 0) {
+            LoadReg(Val, Reg);
+          } else if (Src >= 8) {
+            emitFrameAccess("LDR", Reg, Src - 8, FrameSize, Reg,
+                            Body);
+          } else if (Src != Reg) {
+            Body.emit("ADD", {regOp(Reg), regOp(Src), immOp(0)});
+          }
+        };
+        while (!Copies.empty()) {
+          auto Ready = find_if(Copies, [&](LC3PHICopy &Copy) {
+            return none_of(Copies, [&](LC3PHICopy &Other) {
+              return Other.Src == Copy.Dst;
+            });
+          });
+          if (Ready == Copies.end()) {
+            // Every location left is read before it is written, take one on
+            // a cycle.
+            if (CycleReg < 0) {
+              CycleReg = GetScratch();
             }
-            break;
-          case Instruction::Or:
-            if (auto *DisjointOp = dyn_cast<PossiblyDisjointInst>(BinOp)) {
-              IRBuilder<> Builder(&I);
-
-              Value *AddInst = Builder.CreateAdd(A, B);
-
-              I.replaceAllUsesWith(AddInst);
-              I.eraseFromParent();
+            int Src = find_if(Copies, [&](LC3PHICopy &Copy) {
+                        return any_of(Copies, [&](LC3PHICopy &Other) {
+                          return Other.Dst == Copy.Src;
+                        });
+                      })->Src;
+            EmitLoad(CycleReg, Src, nullptr);
+            for (auto &Copy : Copies) {
+              if (Copy.Src == Src) {
+                Copy.Src = CycleReg;
+              }
             }
-          default:
             continue;
           }
+          if (Ready->Dst < 8) {
+            EmitLoad(Ready->Dst, Ready->Src, Ready->Val);
+          } else {
+            int Reg = Ready->Src;
+            if (Reg < 0 || Reg >= 8) {
+              if (ValReg < 0) {
+                ValReg = GetScratch();
+              }
+              Reg = ValReg;
+              EmitLoad(Reg, Ready->Src, Ready->Val);
+            }
+            if (AddrReg < 0 && getFrameAccessCost(Ready->Dst - 8, FrameSize)) {
+              AddrReg = GetScratch();
+            }
+            emitFrameAccess("STR", Reg, Ready->Dst - 8, FrameSize, AddrReg,
+                            Body);
+          }
+          Copies.erase(Ready);
         }
-      }
+        Body.setSource(Source);
+      };
+
+      // Branches to TrueBB when the condition codes are among CondCodes and
+      // to FalseBB otherwise, falling through to the block laid out next.
+      BasicBlock *NextBB = Pos + 1 < Layout.size() ? Layout[Pos + 1] : nullptr;
+      auto EmitBranch = [&](StringRef CondCodes, BasicBlock *TrueBB,
+                            BasicBlock *FalseBB) {
+        std::string TrueBBName = getIndex(TrueBB, BBNameMap, BBNameCounter);
+        std::string FalseBBName = getIndex(FalseBB, BBNameMap, BBNameCounter);
+        if (!ScavengedRegs.empty()) {
+          // The borrowed registers have to be restored on both edges.
+          std::string TrueLabel =
+              "BR_TRUE_" + std::to_string(++TempLabelCounter);
+          Body.emitBranch(CondCodes, TrueLabel);
+          RestoreScavenged();
+          Body.emitBranch("", FalseBBName);
+          Body.emitLabel(TrueLabel);
+          RestoreScavenged();
+          if (TrueBB != NextBB) {
+            Body.emitBranch("", TrueBBName);
+          }
+          ScavengedRegs.clear();
+        } else if (TrueBB == NextBB) {
+          Body.emitBranch(invertCondCodes(CondCodes), FalseBBName);
+        } else {
+          Body.emitBranch(CondCodes, TrueBBName);
+          if (FalseBB != NextBB) {
+            Body.emitBranch("", FalseBBName);
+          }
+        }
+      };
 
+      // Set when an instruction is lowered together with the next one.
+      Instruction *FusedInst = nullptr;
       for (auto &I : BB) {
+        if (&I == FusedInst) {
+          if (!NoComment) {
+            Body.emitComment(addPrefixInst(I, ""));
+          }
+          continue;
+        }
         if (!NoComment) {
-          FuncInstBufferStream << addPrefixInst(I, ";")
-                               << addRegisterComment(I);
+          Body.emitComment(addPrefixInst(I, "") + addRegisterComment(I));
         }
-        if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
-          auto OpCode = BinOp->getOpcode();
-          if (OpCode == Instruction::Mul || OpCode == Instruction::UDiv) {
-            FuncInstBufferStream << "\tAND\t\tR3, R3, #0\n";
-          }
-
-          int ResOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
-          Value *B = BinOp->getOperand(1);
-          if (int BID = addImmidiate(B, ImmBufferStream, ImmFlag, ImmIDMap,
-                                     ImmIDCounter)) {
-            FuncInstBufferStream << "\tLD\t\tR2, VALUE_" << BID << "\n";
-          } else {
-            int BOff = -getIndex(B, ValueOffsetMap, ValueOffsetCounter);
-            FuncInstBufferStream << "\tLDR\t\tR2, R5, #" << BOff << "\n";
-          }
-          if (OpCode == Instruction::Sub || OpCode == Instruction::UDiv) {
-            FuncInstBufferStream << "\tNOT\t\tR2, R2\n"
-                                 << "\tADD\t\tR2, R2, #1\n";
-          } else if (OpCode == Instruction::URem) {
-            FuncInstBufferStream << "\tNOT\t\tR3, R2\n"
-                                 << "\tADD\t\tR3, R3, #1\n";
+        Body.setSource(&I);
+
+        int Index = RegAlloc.getIndex(&I);
+        ScratchRegs = LC3AllocatableRegs & ~RegAlloc.getBusyRegs(Index) &
+                      ~ClobberMap.lookup(&I);
+        ReservedRegs = ClobberMap.lookup(&I);
+        for (Value *Op : I.operands()) {
+          if (int Reg = RegAlloc.getReg(Op); Reg >= 0) {
+            ReservedRegs |= 1u << Reg;
           }
+        }
+        if (int Reg = RegAlloc.getReg(&I); Reg >= 0) {
+          ReservedRegs |= 1u << Reg;
+        }
+        HandedRegs = 0;
+        ScavengedRegs.clear();
 
+        if (auto *BinOp = dyn_cast<BinaryOperator>(&I)) {
+          auto OpCode = BinOp->getOpcode();
           Value *A = BinOp->getOperand(0);
-          if (int AID = addImmidiate(A, ImmBufferStream, ImmFlag, ImmIDMap,
-                                     ImmIDCounter)) {
-            FuncInstBufferStream << "\tLD\t\tR1, VALUE_" << AID << "\n";
-          } else {
-            int AOff = -getIndex(A, ValueOffsetMap, ValueOffsetCounter);
-            FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << AOff << "\n";
-          }
+          Value *B = BinOp->getOperand(1);
+          SmallVector<int, 17> Digits;
           switch (OpCode) {
           case Instruction::Add:
-            FuncInstBufferStream << "\tADD\t\tR1, R1, R2\n"
-                                 << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
-            break;
-          case Instruction::Sub:
-            FuncInstBufferStream << "\tADD\t\tR1, R1, R2\n"
-                                 << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+          case Instruction::And: {
+            StringRef Op = OpCode == Instruction::Add ? "ADD" : "AND";
+            if (isa<ConstantInt>(A)) {
+              std::swap(A, B);
+            }
+            // Small constants are folded into the immediate form, an add of
+            // a constant just out of its reach takes two of them.
+            int Imm = 0;
+            int64_t Addend = 0;
+            bool IsNear = false;
+            if (auto *ConstInt = dyn_cast<ConstantInt>(B)) {
+              Addend = ConstInt->getSExtValue();
+              IsNear = OpCode == Instruction::Add && Addend >= -32 &&
+                       Addend <= 30;
+            }
+            if (getImm5(B, Imm) || IsNear) {
+              int AReg = UseReg(A);
+              int ResReg = DefReg(&I);
+              if (!getImm5(B, Imm)) {
+                Imm = Addend < 0 ? -16 : 15;
+                Body.emit(Op, {regOp(ResReg), regOp(AReg), immOp(Imm)});
+                AReg = ResReg;
+                Imm = Addend - Imm;
+              }
+              Body.emit(Op, {regOp(ResReg), regOp(AReg), immOp(Imm)});
+              StoreReg(&I, ResReg);
+              break;
+            }
+            int AReg = UseReg(A);
+            int BReg = UseReg(B);
+            int ResReg = DefReg(&I);
+            Body.emit(Op, {regOp(ResReg), regOp(AReg), regOp(BReg)});
+            StoreReg(&I, ResReg);
             break;
-          case Instruction::And:
-            FuncInstBufferStream << "\tAND\t\tR1, R1, R2\n"
-                                 << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+          }
+          case Instruction::Sub: {
+            int AReg = UseReg(A);
+            int BReg = UseReg(B);
+            int NegReg = TempReg(BReg);
+            int ResReg = DefReg(&I);
+            Body.emit("NOT", {regOp(NegReg), regOp(BReg)});
+            Body.emit("ADD", {regOp(NegReg), regOp(NegReg), "#1"});
+            Body.emit("ADD", {regOp(ResReg), regOp(AReg), regOp(NegReg)});
+            StoreReg(&I, ResReg);
             break;
-          case Instruction::Or:
-            FuncInstBufferStream << "\tNOT\t\tR1, R1\n"
-                                 << "\tNOT\t\tR2, R2\n"
-                                 << "\tAND\t\tR1, R1, R2\n"
-                                 << "\tNOT\t\tR1, R1\n"
-                                 << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+          }
+          case Instruction::Or: {
+            int AReg = UseReg(A);
+            int BReg = UseReg(B);
+            int NotAReg = TempReg(AReg);
+            int NotBReg = TempReg(BReg);
+            int ResReg = DefReg(&I);
+            Body.emit("NOT", {regOp(NotAReg), regOp(AReg)});
+            Body.emit("NOT", {regOp(NotBReg), regOp(BReg)});
+            Body.emit("AND", {regOp(NotAReg), regOp(NotAReg), regOp(NotBReg)});
+            Body.emit("NOT", {regOp(ResReg), regOp(NotAReg)});
+            StoreReg(&I, ResReg);
             break;
+          }
           case Instruction::Shl:
-            FuncInstBufferStream << "SHL_LOOP_" << ++TempLabelCounter << "\n"
-                                 << "\tADD\t\tR1, R1, R1\n"
-                                 << "\tADD\t\tR2, R2, #-1\n"
-                                 << "\tBRp\t\tSHL_LOOP_" << TempLabelCounter
-                                 << "\n"
-                                 << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+            if (isUnrolledShl(BinOp)) {
+              auto Shift = cast<ConstantInt>(B)->getZExtValue();
+              if (Shift >= 16) {
+                int ResReg = DefReg(&I);
+                Body.emit("AND", {regOp(ResReg), regOp(ResReg), "#0"});
+                StoreReg(&I, ResReg);
+                break;
+              }
+              int AReg = UseReg(A);
+              int ResReg = DefReg(&I);
+              if (Shift) {
+                Body.emit("ADD", {regOp(ResReg), regOp(AReg), regOp(AReg)});
+              } else if (ResReg != AReg) {
+                Body.emit("ADD", {regOp(ResReg), regOp(AReg), "#0"});
+              }
+              for (unsigned i = 1; i < Shift; i++) {
+                Body.emit("ADD", {regOp(ResReg), regOp(ResReg), regOp(ResReg)});
+              }
+              StoreReg(&I, ResReg);
+              break;
+            }
+            LoadReg(B, 2);
+            LoadReg(A, 1);
+            Body.emit("ADD", {"R2", "R2", "#0"});
+            Body.emitBranch("nz", "SHL_END_" + Twine(++TempLabelCounter));
+            Body.emitLabel("SHL_LOOP_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R1", "R1", "R1"});
+            Body.emit("ADD", {"R2", "R2", "#-1"});
+            Body.emitBranch("p", "SHL_LOOP_" + Twine(TempLabelCounter));
+            Body.emitLabel("SHL_END_" + Twine(TempLabelCounter));
+            StoreReg(&I, 1);
             break;
           case Instruction::Mul:
+            if (Value *X = getMulChain(BinOp, Digits)) {
+              // Horner's rule from the top digit: double, then add the
+              // operand or its negation for a non-zero digit.
+              if (Digits.empty()) {
+                int ResReg = DefReg(&I);
+                Body.emit("AND", {regOp(ResReg), regOp(ResReg), "#0"});
+                StoreReg(&I, ResReg);
+                break;
+              }
+              int XReg = UseReg(X);
+              int ResReg = DefReg(&I);
+              if (ResReg == XReg && count_if(Digits, [](int Digit) {
+                                      return Digit != 0;
+                                    }) > 1) {
+                ResReg = GetScratch();
+              }
+              int NegReg = XReg;
+              if (is_contained(Digits, -1)) {
+                NegReg = Digits.size() == 1 ? ResReg : GetScratch();
+                Body.emit("NOT", {regOp(NegReg), regOp(XReg)});
+                Body.emit("ADD", {regOp(NegReg), regOp(NegReg), "#1"});
+              }
+              int TopReg = Digits.back() > 0 ? XReg : NegReg;
+              if (Digits.size() == 1 && TopReg != ResReg) {
+                Body.emit("ADD", {regOp(ResReg), regOp(TopReg), "#0"});
+              }
+              for (int Pos = Digits.size() - 2; Pos >= 0; Pos--) {
+                int SrcReg = Pos == (int)Digits.size() - 2 ? TopReg : ResReg;
+                Body.emit("ADD", {regOp(ResReg), regOp(SrcReg), regOp(SrcReg)});
+                if (Digits[Pos]) {
+                  Body.emit("ADD", {regOp(ResReg), regOp(ResReg),
+                                    regOp(Digits[Pos] > 0 ? XReg : NegReg)});
+                }
+              }
+              StoreReg(&I, ResReg);
+              break;
+            }
+
+            // Shift and add from the lowest bit of the multiplier, clearing
+            // the bits done so the loop stops after its highest set bit, 16
+            // steps at most. With -signed-mul a negative multiplier is
+            // negated first, along with the multiplicand, as it has fewer
+            // significant bits.
+            LoadReg(B, 2);
+            LoadReg(A, 1);
+            ++TempLabelCounter;
             if (SignedMul) {
-              FuncInstBufferStream << "\tBRzp\tMUL_LOOP_"
-                                   << TempLabelCounter + 1 << "\n"
-                                   << "\tNOT\t\tR1, R1\n"
-                                   << "\tADD\t\tR1, R1, #1\n"
-                                   << "\tNOT\t\tR2, R2\n"
-                                   << "\tADD\t\tR2, R2, #1\n";
+              Body.emit("ADD", {"R2", "R2", "#0"});
+              Body.emitBranch("zp", "MUL_ABS_" + Twine(TempLabelCounter));
+              Body.emit("NOT", {"R1", "R1"});
+              Body.emit("ADD", {"R1", "R1", "#1"});
+              Body.emit("NOT", {"R2", "R2"});
+              Body.emit("ADD", {"R2", "R2", "#1"});
+              Body.emitLabel("MUL_ABS_" + Twine(TempLabelCounter));
             }
-            FuncInstBufferStream
-                << "MUL_LOOP_" << ++TempLabelCounter << "\n"
-                << "\tBRz\t\tMUL_END_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR3, R3, R1\n"
-                << "\tADD\t\tR2, R2, #-1\n"
-                << "\tBR\t\tMUL_LOOP_" << TempLabelCounter << "\n"
-                << "MUL_END_" << TempLabelCounter << "\n"
-                << "\tSTR\t\tR3, R5, #" << ResOff << "\n";
+            Body.emit("AND", {"R3", "R3", "#0"});
+            Body.emit("AND", {"R4", "R4", "#0"});
+            Body.emit("ADD", {"R4", "R4", "#1"});
+            Body.emit("ADD", {"R2", "R2", "#0"});
+            Body.emitBranch("z", "MUL_END_" + Twine(TempLabelCounter));
+            Body.emitLabel("MUL_LOOP_" + Twine(TempLabelCounter));
+            Body.emit("AND", {"R0", "R2", "R4"});
+            Body.emitBranch("z", "MUL_NEXT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R3", "R3", "R1"});
+            Body.emit("NOT", {"R0", "R0"});
+            Body.emit("AND", {"R2", "R2", "R0"});
+            Body.emitBranch("z", "MUL_END_" + Twine(TempLabelCounter));
+            Body.emitLabel("MUL_NEXT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R1", "R1", "R1"});
+            Body.emit("ADD", {"R4", "R4", "R4"});
+            Body.emitBranch("", "MUL_LOOP_" + Twine(TempLabelCounter));
+            Body.emitLabel("MUL_END_" + Twine(TempLabelCounter));
+            StoreReg(&I, 3);
             break;
           case Instruction::UDiv:
-            FuncInstBufferStream
-                << "UDIV_LOOP_" << ++TempLabelCounter << "\n"
-                << "\tBRnz\tUDIV_END_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR3, R3, #1\n"
-                << "\tADD\t\tR1, R1, R2\n"
-                << "\tBR\t\tUDIV_LOOP_" << TempLabelCounter << "\n"
-                << "UDIV_END_" << TempLabelCounter << "\n"
-                << "\tBRz\t\tUDIV_POST_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR3, R3, #-1\n"
-                << "UDIV_POST_" << TempLabelCounter << "\n"
-                << "\tSTR\t\tR3, R5, #" << ResOff << "\n";
-            break;
-          case Instruction::URem:
-            FuncInstBufferStream
-                << "UREM_LOOP_" << ++TempLabelCounter << "\n"
-                << "\tBRnz\tUREM_END_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR1, R1, R3\n"
-                << "\tBR\t\tUREM_LOOP_" << TempLabelCounter << "\n"
-                << "UREM_END_" << TempLabelCounter << "\n"
-                << "\tBRz\t\tUREM_POST_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR1, R1, R2\n"
-                << "UREM_POST_" << TempLabelCounter << "\n"
-                << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+          case Instruction::URem: {
+            // Binary long division, shifting the dividend into the
+            // remainder from its top set bit on, 16 steps at most. The
+            // remainder stays below twice the divisor, so the trial
+            // subtraction can not overflow unless the divisor has its top
+            // bit set, and then the quotient is 0 or 1.
+            LoadReg(B, 2);
+            LoadReg(A, 1);
+            Body.emit("AND", {"R3", "R3", "#0"});
+            Body.emit("ADD", {"R2", "R2", "#0"});
+            Body.emitBranch("n", "UDIV_BIG_" + Twine(++TempLabelCounter));
+            Body.emit("NOT", {"R2", "R2"});
+            Body.emit("ADD", {"R2", "R2", "#1"});
+            Body.emit("AND", {"R4", "R4", "#0"});
+            Body.emit("ADD", {"R4", "R4", "#-16"});
+            Body.emit("ADD", {"R1", "R1", "#0"});
+            Body.emitBranch("z", "UDIV_END_" + Twine(TempLabelCounter));
+            Body.emitBranch("n", "UDIV_LOOP_" + Twine(TempLabelCounter));
+            Body.emitLabel("UDIV_SKIP_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R4", "R4", "#1"});
+            Body.emit("ADD", {"R1", "R1", "R1"});
+            Body.emitBranch("zp", "UDIV_SKIP_" + Twine(TempLabelCounter));
+            Body.emitLabel("UDIV_LOOP_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R3", "R3", "R3"});
+            Body.emit("ADD", {"R1", "R1", "#0"});
+            Body.emitBranch("zp", "UDIV_SHIFT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R3", "R3", "#1"});
+            Body.emitLabel("UDIV_SHIFT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R1", "R1", "R1"});
+            Body.emit("ADD", {"R0", "R3", "R2"});
+            Body.emitBranch("n", "UDIV_NEXT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R3", "R0", "#0"});
+            Body.emit("ADD", {"R1", "R1", "#1"});
+            Body.emitLabel("UDIV_NEXT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R4", "R4", "#1"});
+            Body.emitBranch("n", "UDIV_LOOP_" + Twine(TempLabelCounter));
+            Body.emitBranch("", "UDIV_END_" + Twine(TempLabelCounter));
+            Body.emitLabel("UDIV_BIG_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R3", "R1", "#0"});
+            Body.emit("AND", {"R1", "R1", "#0"});
+            Body.emit("ADD", {"R3", "R3", "#0"});
+            Body.emitBranch("zp", "UDIV_END_" + Twine(TempLabelCounter));
+            Body.emit("NOT", {"R0", "R2"});
+            Body.emit("ADD", {"R0", "R0", "#1"});
+            Body.emit("ADD", {"R0", "R3", "R0"});
+            Body.emitBranch("n", "UDIV_END_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R3", "R0", "#0"});
+            Body.emit("ADD", {"R1", "R1", "#1"});
+            Body.emitLabel("UDIV_END_" + Twine(TempLabelCounter));
+
+            // The canonicalization puts a udiv and a urem of the same
+            // operands next to each other, the second one is done here.
+            auto *Next = dyn_cast_or_null<BinaryOperator>(I.getNextNode());
+            if (!Next || Next->getOperand(0) != A ||
+                Next->getOperand(1) != B ||
+                Next->getOpcode() != (OpCode == Instruction::UDiv
+                                          ? Instruction::URem
+                                          : Instruction::UDiv)) {
+              StoreReg(&I, OpCode == Instruction::UDiv ? 1 : 3);
+              break;
+            }
+            FusedInst = Next;
+            SmallVector<std::pair<int, int>, 2> Copies;
+            for (Instruction *Res : {&I, cast<Instruction>(Next)}) {
+              int Reg = Res->getOpcode() == Instruction::UDiv ? 1 : 3;
+              if (int Home = RegAlloc.getReg(Res); Home >= 0) {
+                Copies.push_back({Home, Reg});
+              } else {
+                StoreReg(Res, Reg);
+              }
+            }
+            emitParallelCopies(
+                Copies, RegAlloc.getBusyRegs(RegAlloc.getIndex(Next)), Body);
             break;
-          case Instruction::LShr:
-            // R2: counter, R1: result, R0: temporary register
-            // R3: source mask, R4: destiny mask
-            FuncInstBufferStream
-                << "LSHR_OUT_LOOP_" << ++TempLabelCounter << "\n"
-                << "\tAND\t\tR0, R0, #0\n"
-                << "\tAND\t\tR3, R3, #0\n"
-                << "\tADD\t\tR3, R3, #2\n"
-                << "\tAND\t\tR4, R4, #0\n"
-                << "\tADD\t\tR4, R4, #1\n"
-                << "LSHR_IN_LOOP_" << TempLabelCounter << "\n"
-                << "\tNOT\t\tR4, R4\n"
-                << "\tAND\t\tR1, R1, R4\n"
-                << "\tNOT\t\tR4, R4\n"
-                << "\tAND\t\tR0, R1, R3\n"
-                << "\tBRz\t\tLSHR_SKIP_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR1, R1, R4\n"
-                << "LSHR_SKIP_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR3, R3, R3\n"
-                << "\tADD\t\tR4, R4, R4\n"
-                << "\tBRnp\tLSHR_IN_LOOP_" << TempLabelCounter << "\n"
-                << "\tADD\t\tR2, R2, #-1\n"
-                << "\tBRp\t\tLSHR_OUT_LOOP_" << TempLabelCounter << "\n"
-                << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+          }
+          case Instruction::LShr: {
+            // R0: result, R1: source, R2: temporary register
+            // R3: source mask, R4: result mask
+            auto *ShiftAmt = dyn_cast<ConstantInt>(B);
+            int Shift = -1;
+            if (ShiftAmt) {
+              Shift = std::min<uint64_t>(ShiftAmt->getZExtValue(), 16);
+            }
+            LoadReg(A, 1);
+            if (Shift >= 12) {
+              // At most four bits are left, test them one by one. The top
+              // one is the sign.
+              Body.emit("AND", {"R0", "R0", "#0"});
+              for (int Bit = Shift; Bit < 15; Bit++) {
+                LoadReg(ConstantInt::get(WordTy, 1 << Bit), 2);
+                Body.emit("AND", {"R2", "R1", "R2"});
+                Body.emitBranch("z", "LSHR_BIT_" + Twine(++TempLabelCounter));
+                Body.emit("ADD", {"R0", "R0", immOp((1 << (Bit - Shift)))});
+                Body.emitLabel("LSHR_BIT_" + Twine(TempLabelCounter));
+              }
+              if (Shift < 16) {
+                Body.emit("ADD", {"R1", "R1", "#0"});
+                Body.emitBranch("zp", "LSHR_BIT_" + Twine(++TempLabelCounter));
+                Body.emit("ADD", {"R0", "R0", immOp((1 << (15 - Shift)))});
+                Body.emitLabel("LSHR_BIT_" + Twine(TempLabelCounter));
+              }
+              StoreReg(&I, 0);
+              break;
+            }
+
+            // Clear the bits shifted out, then move the source bits down
+            // from the mask of the shift amount, clearing them as they are
+            // done so the walk stops after the highest one.
+            ++TempLabelCounter;
+            if (ShiftAmt) {
+              LoadReg(ConstantInt::get(WordTy, 1 << Shift), 3);
+              LoadReg(ConstantInt::get(WordTy, -(1 << Shift)), 2);
+            } else {
+              LoadReg(B, 2);
+              Body.emit("AND", {"R3", "R3", "#0"});
+              Body.emit("ADD", {"R3", "R3", "#1"});
+              Body.emit("ADD", {"R2", "R2", "#0"});
+              Body.emitBranch("nz", "LSHR_MASKED_" + Twine(TempLabelCounter));
+              Body.emitLabel("LSHR_MASK_" + Twine(TempLabelCounter));
+              Body.emit("ADD", {"R3", "R3", "R3"});
+              Body.emit("ADD", {"R2", "R2", "#-1"});
+              Body.emitBranch("p", "LSHR_MASK_" + Twine(TempLabelCounter));
+              Body.emitLabel("LSHR_MASKED_" + Twine(TempLabelCounter));
+              Body.emit("NOT", {"R2", "R3"});
+              Body.emit("ADD", {"R2", "R2", "#1"});
+            }
+            Body.emit("AND", {"R0", "R0", "#0"});
+            Body.emit("AND", {"R4", "R4", "#0"});
+            Body.emit("ADD", {"R4", "R4", "#1"});
+            Body.emit("AND", {"R1", "R1", "R2"});
+            Body.emitBranch("z", "LSHR_END_" + Twine(TempLabelCounter));
+            Body.emitLabel("LSHR_LOOP_" + Twine(TempLabelCounter));
+            Body.emit("AND", {"R2", "R1", "R3"});
+            Body.emitBranch("z", "LSHR_NEXT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R0", "R0", "R4"});
+            Body.emit("NOT", {"R2", "R2"});
+            Body.emit("AND", {"R1", "R1", "R2"});
+            Body.emitBranch("z", "LSHR_END_" + Twine(TempLabelCounter));
+            Body.emitLabel("LSHR_NEXT_" + Twine(TempLabelCounter));
+            Body.emit("ADD", {"R4", "R4", "R4"});
+            Body.emit("ADD", {"R3", "R3", "R3"});
+            Body.emitBranch("", "LSHR_LOOP_" + Twine(TempLabelCounter));
+            Body.emitLabel("LSHR_END_" + Twine(TempLabelCounter));
+            StoreReg(&I, 0);
             break;
+          }
           default:
             return UnsupportInst(I);
           }
         } else if (auto *LoadI = dyn_cast<LoadInst>(&I)) {
-          int ResOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
           Value *Op = LoadI->getPointerOperand();
-          int OpOff = -getIndex(Op, ValueOffsetMap, ValueOffsetCounter);
+          int OpSlot = getIndex(Op, ValueOffsetMap, ValueOffsetCounter);
 
-          FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << OpOff << "\n"
-                               << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+          int ResReg = DefReg(&I);
+          emitFrameAccess("LDR", ResReg, OpSlot, FrameSize, ResReg,
+                          Body);
+          StoreReg(&I, ResReg);
         } else if (auto *StoreI = dyn_cast<StoreInst>(&I)) {
-          Value *Val = StoreI->getValueOperand();
-          if (int ValID = addImmidiate(Val, ImmBufferStream, ImmFlag, ImmIDMap,
-                                       ImmIDCounter)) {
-            FuncInstBufferStream << "\tLD\t\tR1, VALUE_" << ValID << "\n";
-          } else {
-            int ValOff = -getIndex(Val, ValueOffsetMap, ValueOffsetCounter);
-            FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << ValOff << "\n";
-          }
+          int ValReg = UseReg(StoreI->getValueOperand());
 
           Value *Ptr = StoreI->getPointerOperand();
-          int PtrOff = -getIndex(Ptr, ValueOffsetMap, ValueOffsetCounter);
+          int PtrSlot = getIndex(Ptr, ValueOffsetMap, ValueOffsetCounter);
 
-          FuncInstBufferStream << "\tSTR\t\tR1, R5, #" << PtrOff << "\n";
+          int AddrReg =
+              getFrameAccessCost(PtrSlot, FrameSize) ? GetScratch() : ValReg;
+          emitFrameAccess("STR", ValReg, PtrSlot, FrameSize, AddrReg,
+                          Body);
         } else if (auto *BranchI = dyn_cast<BranchInst>(&I)) {
-          FuncInstBufferStream << "\tLEA\t\tR7, " << BBName << "\n";
           if (BranchI->isUnconditional()) {
             BasicBlock *SucBB = BranchI->getSuccessor(0);
             std::string SucBBName = getIndex(SucBB, BBNameMap, BBNameCounter);
 
-            FuncInstBufferStream << "\tBR\t\t" << SucBBName << "\n";
-          } else {
-            Value *Con = BranchI->getCondition();
-            if (int ConID = addImmidiate(Con, ImmBufferStream, ImmFlag,
-                                         ImmIDMap, ImmIDCounter)) {
-              FuncInstBufferStream << "\tLD\t\tR1, VALUE_" << ConID << "\n";
-            } else {
-              int ConOff = -getIndex(Con, ValueOffsetMap, ValueOffsetCounter);
-              FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << ConOff << "\n";
+            EmitPHICopies(SucBB);
+            RestoreScavenged();
+            ScavengedRegs.clear();
+            if (SucBB != NextBB) {
+              Body.emitBranch("", SucBBName);
             }
-
-            BasicBlock *IfTrueBB = BranchI->getSuccessor(0);
-            std::string IfTrueBBName =
-                getIndex(IfTrueBB, BBNameMap, BBNameCounter);
-
-            BasicBlock *IfFalseBB = BranchI->getSuccessor(1);
-            std::string IfFalseBBName =
-                getIndex(IfFalseBB, BBNameMap, BBNameCounter);
-
-            FuncInstBufferStream << "\tBRz\t\t" << IfFalseBBName << "\n"
-                                 << "\tBR\t\t" << IfTrueBBName << "\n";
+          } else {
+            TestReg(BranchI->getCondition());
+            EmitBranch("np", BranchI->getSuccessor(0),
+                       BranchI->getSuccessor(1));
+          }
+        } else if (auto *ICmpI = dyn_cast<ICmpInst>(&I);
+                   ICmpI && getFusedBranch(ICmpI)) {
+          // Branch on the condition codes of the difference directly.
+          BranchInst *BranchI = getFusedBranch(ICmpI);
+          StringRef CondCodes = getCondCodes(ICmpI->getPredicate());
+          if (CondCodes.empty()) {
+            return UnsupportInst(I);
           }
-        } else if (auto *ICmpI = dyn_cast<ICmpInst>(&I)) {
-          FuncInstBufferStream << "\tAND\t\tR3, R3, #0\n";
-
-          int ResOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
 
           Value *A = ICmpI->getOperand(0);
-          if (int AID = addImmidiate(A, ImmBufferStream, ImmFlag, ImmIDMap,
-                                     ImmIDCounter)) {
-            FuncInstBufferStream << "\tLD\t\tR1, VALUE_" << AID << "\n";
+          Value *B = ICmpI->getOperand(1);
+          int Imm;
+          if (getImm5(B, Imm) && Imm == 0) {
+            TestReg(A);
+          } else if (getImm5(B, Imm)) {
+            int AReg = UseReg(A);
+            int DiffReg = TempReg(AReg);
+            Body.emit("ADD", {regOp(DiffReg), regOp(AReg), immOp(Imm)});
           } else {
-            int AOff = -getIndex(A, ValueOffsetMap, ValueOffsetCounter);
-            FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << AOff << "\n";
+            int AReg = UseReg(A);
+            int BReg = UseReg(B);
+            int DiffReg = TempReg(BReg);
+            if (!isa<ConstantInt>(B)) {
+              Body.emit("NOT", {regOp(DiffReg), regOp(BReg)});
+              Body.emit("ADD", {regOp(DiffReg), regOp(DiffReg), "#1"});
+              BReg = DiffReg;
+            }
+            Body.emit("ADD", {regOp(DiffReg), regOp(AReg), regOp(BReg)});
           }
 
+          EmitBranch(CondCodes, BranchI->getSuccessor(0),
+                     BranchI->getSuccessor(1));
+          FusedInst = BranchI;
+        } else if (auto *ICmpI = dyn_cast<ICmpInst>(&I)) {
+          Value *A = ICmpI->getOperand(0);
           Value *B = ICmpI->getOperand(1);
-          if (int BID = addImmidiate(B, ImmBufferStream, ImmFlag, ImmIDMap,
-                                     ImmIDCounter)) {
-            FuncInstBufferStream << "\tLD\t\tR2, VALUE_" << BID << "\n";
+          int AReg = UseReg(A);
+          int Imm;
+          bool IsImm = getImm5(B, Imm);
+          int BReg = IsImm ? AReg : UseReg(B);
+
+          // The result is cleared before the compare sets the condition
+          // codes, so it must not overwrite an operand.
+          int ResReg = RegAlloc.getReg(&I);
+          if (ResReg < 0 || ResReg == AReg || ResReg == BReg) {
+            ResReg = GetScratch();
+          }
+          int DiffReg = TempReg(BReg);
+          Body.emit("AND", {regOp(ResReg), regOp(ResReg), "#0"});
+          if (!isa<ConstantInt>(B)) {
+            Body.emit("NOT", {regOp(DiffReg), regOp(BReg)});
+            Body.emit("ADD", {regOp(DiffReg), regOp(DiffReg), "#1"});
+            BReg = DiffReg;
+          }
+          if (IsImm) {
+            Body.emit("ADD", {regOp(DiffReg), regOp(AReg), immOp(Imm)});
           } else {
-            int BOff = -getIndex(B, ValueOffsetMap, ValueOffsetCounter);
-            FuncInstBufferStream << "\tLDR\t\tR2, R5, #" << BOff << "\n"
-                                 << "\tNOT\t\tR2, R2\n"
-                                 << "\tADD\t\tR2, R2, #1\n";
+            Body.emit("ADD", {regOp(DiffReg), regOp(AReg), regOp(BReg)});
           }
 
-          FuncInstBufferStream << "\tADD\t\tR1, R1, R2\n";
-
           switch (ICmpI->getPredicate()) {
           case CmpInst::ICMP_EQ:
-            FuncInstBufferStream << "\tBRnp\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("np", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_NE:
-            FuncInstBufferStream << "\tBRz\t\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("z", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_SGT:
-            FuncInstBufferStream << "\tBRnz\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("nz", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_SGE:
-            FuncInstBufferStream << "\tBRn\t\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("n", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_SLT:
-            FuncInstBufferStream << "\tBRzp\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("zp", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_SLE:
-            FuncInstBufferStream << "\tBRp\t\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("p", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_UGT:
-            FuncInstBufferStream << "\tBRnz\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("nz", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_UGE:
-            FuncInstBufferStream << "\tBRn\t\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("n", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_ULT:
-            FuncInstBufferStream << "\tBRzp\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("zp", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           case CmpInst::ICMP_ULE:
-            FuncInstBufferStream << "\tBRp\t\tICMP_END_" << ++TempLabelCounter
-                                 << "\n";
+            Body.emitBranch("p", "ICMP_END_" + Twine(++TempLabelCounter));
             break;
           default:
             return UnsupportInst(I);
           }
 
-          FuncInstBufferStream << "\tADD\t\tR3, R3, #1\n"
-                               << "ICMP_END_" << TempLabelCounter << "\n"
-                               << "\tSTR\t\tR3, R5, #" << ResOff << "\n";
+          Body.emit("ADD", {regOp(ResReg), regOp(ResReg), "#1"});
+          Body.emitLabel("ICMP_END_" + Twine(TempLabelCounter));
+          StoreReg(&I, ResReg);
         } else if (auto *CallI = dyn_cast<CallInst>(&I)) {
           if (Function *Func = CallI->getCalledFunction()) {
             if (Func->getName() == "printStr") {
               if (CallI->arg_size() == 1) {
                 Value *Str = CallI->getArgOperand(0);
 
-                if (int StrID = addString(Str, ImmBufferStream, ImmFlag,
-                                          ImmIDMap, ImmIDCounter)) {
-                  FuncInstBufferStream << "\tLEA\t\tR0, VALUE_" << StrID
-                                       << "\n";
+                if (std::string Ref = addString(Str, Pool); !Ref.empty()) {
+                  Body.emit("LEA", {"R0", Ref});
+                } else if (isa<Constant>(Str)) {
+                  LoadReg(Str, 0);
                 } else {
-                  int StrOff =
-                      -getIndex(Str, ValueOffsetMap, ValueOffsetCounter);
-                  FuncInstBufferStream << "\tADD\t\tR0, R5, #" << StrOff
-                                       << "\n";
+                  int StrSlot =
+                      getIndex(Str, ValueOffsetMap, ValueOffsetCounter);
+                  emitFrameAccess("ADD", 0, StrSlot, FrameSize, 0,
+                                  Body);
                 }
 
-                FuncInstBufferStream << "\tPUTS\n";
+                Body.emit("PUTS");
               } else {
                 return UnsupportInst(I);
               }
             } else if (Func->getName() == "printStrAddr") {
               if (CallI->arg_size() == 1) {
-                Value *Addr = CallI->getArgOperand(0);
-                if (int AddrID = addImmidiate(Addr, ImmBufferStream, ImmFlag,
-                                              ImmIDMap, ImmIDCounter)) {
-                  FuncInstBufferStream << "\tLD\t\tR0, VALUE_" << AddrID
-                                       << "\n";
-                } else {
-                  int AddrOff =
-                      -getIndex(Addr, ValueOffsetMap, ValueOffsetCounter);
-                  FuncInstBufferStream << "\tLDR\t\tR0, R5, #" << AddrOff
-                                       << "\n";
-                }
-
-                FuncInstBufferStream << "\tPUTS\n";
+                LoadReg(CallI->getArgOperand(0), 0);
+                Body.emit("PUTS");
               } else {
                 return UnsupportInst(I);
               }
             } else if (Func->getName() == "printCharAddr") {
               if (CallI->arg_size() == 1) {
-                Value *Addr = CallI->getArgOperand(0);
-                if (int AddrID = addImmidiate(Addr, ImmBufferStream, ImmFlag,
-                                              ImmIDMap, ImmIDCounter)) {
-                  FuncInstBufferStream << "\tLD\t\tR1, VALUE_" << AddrID
-                                       << "\n";
-                } else {
-                  int AddrOff =
-                      -getIndex(Addr, ValueOffsetMap, ValueOffsetCounter);
-                  FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << AddrOff
-                                       << "\n";
-                }
-
-                FuncInstBufferStream << "\tLDR\t\tR0, R1, #0\n"
-                                     << "\tOUT\n";
+                LoadReg(CallI->getArgOperand(0), 0);
+                Body.emit("LDR", {"R0", "R0", "#0"});
+                Body.emit("OUT");
               } else {
                 return UnsupportInst(I);
               }
             } else if (Func->getName() == "printChar") {
               if (CallI->arg_size() == 1) {
-                Value *Char = CallI->getArgOperand(0);
-                if (int CharID = addImmidiate(Char, ImmBufferStream, ImmFlag,
-                                              ImmIDMap, ImmIDCounter)) {
-                  FuncInstBufferStream << "\tLD\t\tR0, VALUE_" << CharID
-                                       << "\n";
-                } else {
-                  int CharOff =
-                      -getIndex(Char, ValueOffsetMap, ValueOffsetCounter);
-                  FuncInstBufferStream << "\tLDR\t\tR0, R5, #" << CharOff
-                                       << "\n";
-                }
-
-                FuncInstBufferStream << "\tOUT\n";
+                LoadReg(CallI->getArgOperand(0), 0);
+                Body.emit("OUT");
               } else {
                 return UnsupportInst(I);
               }
@@ -744,24 +2618,29 @@ PreservedAnalyses LLVMIRToLC3Pass::run(Module &M, ModuleAnalysisManager &MAM) {
                 Value *Str = CallI->getArgOperand(0);
                 StringRef Content = getString(Str);
                 if (Content != "") {
-                  FuncInstBufferStream << Content << "\n";
+                  size_t From = Body.size();
+                  append_range(Body.getInsts(), parseLC3(Content));
+                  Body.pin(From);
                 } else {
                   return UnsupportInst(I);
                 }
               } else {
                 return UnsupportInst(I);
               }
+            } else if (Func->getName() == "dumpLC3Counters") {
+              if (Instrument) {
+                Body.emit("LD", {"R7", Pool.addAddress("LC3_DUMP_COUNTERS")});
+                Body.emit("JSRR", {"R7"});
+              }
             } else if (Func->getName() == "loadLabel") {
               if (CallI->arg_size() == 1) {
-                int DesOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
                 Value *Str = CallI->getArgOperand(0);
                 StringRef Label = getString(Str);
 
                 if (Label != "") {
-                  FuncInstBufferStream << "\tLD\t\tR1, " << Label << "\n"
-                                       << "\tSTR\t\tR1, R5, #" << DesOff
-                                       << "\n";
+                  int DesReg = DefReg(&I);
+                  Body.emit("LD", {regOp(DesReg), Label.str()});
+                  StoreReg(&I, DesReg);
                 } else {
                   return UnsupportInst(I);
                 }
@@ -770,36 +2649,21 @@ PreservedAnalyses LLVMIRToLC3Pass::run(Module &M, ModuleAnalysisManager &MAM) {
               }
             } else if (Func->getName() == "loadAddr") {
               if (CallI->arg_size() == 1) {
-                int DesOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
-                Value *Addr = CallI->getArgOperand(0);
-                if (int AddrID = addImmidiate(Addr, ImmBufferStream, ImmFlag,
-                                              ImmIDMap, ImmIDCounter)) {
-                  FuncInstBufferStream << "\tLD\t\tR1, VALUE_" << AddrID
-                                       << "\n";
-                } else {
-                  int AddrOff =
-                      -getIndex(Addr, ValueOffsetMap, ValueOffsetCounter);
-                  FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << AddrOff
-                                       << "\n";
-                }
-
-                FuncInstBufferStream << "\tLDR\t\tR1, R1, #0\n"
-                                     << "\tSTR\t\tR1, R5, #" << DesOff << "\n";
+                int AddrReg = UseReg(CallI->getArgOperand(0));
+                int DesReg = DefReg(&I);
+                Body.emit("LDR", {regOp(DesReg), regOp(AddrReg), "#0"});
+                StoreReg(&I, DesReg);
               } else {
                 return UnsupportInst(I);
               }
             } else if (Func->getName() == "storeLabel") {
               if (CallI->arg_size() == 2) {
-                Value *Src = CallI->getArgOperand(0);
-                int SrcOff = -getIndex(Src, ValueOffsetMap, ValueOffsetCounter);
-
                 Value *Str = CallI->getArgOperand(1);
                 StringRef Label = getString(Str);
 
                 if (Label != "") {
-                  FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << SrcOff << "\n"
-                                       << "\tST\t\tR1, " << Label << "\n";
+                  int SrcReg = UseReg(CallI->getArgOperand(0));
+                  Body.emit("ST", {regOp(SrcReg), Label.str()});
                 } else {
                   return UnsupportInst(I);
                 }
@@ -808,70 +2672,68 @@ PreservedAnalyses LLVMIRToLC3Pass::run(Module &M, ModuleAnalysisManager &MAM) {
               }
             } else if (Func->getName() == "storeAddr") {
               if (CallI->arg_size() == 2) {
-                Value *Src = CallI->getArgOperand(0);
-                int SrcOff = -getIndex(Src, ValueOffsetMap, ValueOffsetCounter);
-                FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << SrcOff << "\n";
+                int SrcReg = UseReg(CallI->getArgOperand(0));
 
                 Value *Addr = CallI->getArgOperand(1);
-                if (int AddrID = addImmidiate(Addr, ImmBufferStream, ImmFlag,
-                                              ImmIDMap, ImmIDCounter)) {
-                  FuncInstBufferStream << "\tSTI\t\tR1, VALUE_" << AddrID
-                                       << "\n";
+                if (std::string Ref = addImmidiate(Addr, Pool); !Ref.empty()) {
+                  Body.emit("STI", {regOp(SrcReg), Ref});
                 } else {
-                  int AddrOff =
-                      -getIndex(Addr, ValueOffsetMap, ValueOffsetCounter);
-                  FuncInstBufferStream << "\tLDR\t\tR2, R5, #" << AddrOff
-                                       << "\n"
-                                       << "\tSTR\t\tR1, R2, #0\n";
+                  int AddrReg = UseReg(Addr);
+                  Body.emit("STR", {regOp(SrcReg), regOp(AddrReg), "#0"});
                 }
               } else {
                 return UnsupportInst(I);
               }
             } else if (Func->getName() == "readLabelAddr") {
               if (CallI->arg_size() == 1) {
-                int DesOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
                 Value *Str = CallI->getArgOperand(0);
                 StringRef Label = getString(Str);
 
                 if (Label != "") {
-                  FuncInstBufferStream << "\tLEA\t\tR1, " << Label << "\n"
-                                       << "\tSTR\t\tR1, R5, #" << DesOff
-                                       << "\n";
+                  int DesReg = DefReg(&I);
+                  Body.emit("LEA", {regOp(DesReg), Label.str()});
+                  StoreReg(&I, DesReg);
                 } else {
                   return UnsupportInst(I);
                 }
               } else {
                 return UnsupportInst(I);
               }
+            } else if (Function *Callee =
+                           getTailCallee(CallI, StaticFuncs)) {
+              for (unsigned i = 0; i < CallI->arg_size(); i++) {
+                LoadReg(CallI->getArgOperand(i), i);
+              }
+              if (Callee == &F) {
+                if (TailCallLabel.empty()) {
+                  TailCallLabel =
+                      "TAIL_CALL_" + std::to_string(++TempLabelCounter);
+                }
+                Body.emitBranch("", TailCallLabel);
+              } else {
+                // The callee returns to the caller of the function, whose
+                // registers are restored first.
+                int JumpReg = CallI->arg_size();
+                Body.emitMark(RestoreMark);
+                Body.emit("LD", {regOp(JumpReg),
+                                 Pool.addAddress(Callee->getName())});
+                Body.emit("JMP", {regOp(JumpReg)});
+              }
+              FusedInst = I.getNextNode();
             } else if (CallI->arg_size() <= 5 && FuncLabelMap.count(Func)) {
               StringRef CalledFuncName = Func->getName();
-              if (int ArgSize = CallI->arg_size()) {
-                for (int i = 0; i < ArgSize; i++) {
-                  Value *Arg = CallI->getArgOperand(i);
-                  if (int ArgID = addImmidiate(Arg, ImmBufferStream, ImmFlag,
-                                               ImmIDMap, ImmIDCounter)) {
-                    FuncInstBufferStream << "\tLD\t\tR" << i << ", VALUE_"
-                                         << ArgID << "\n";
-                  } else {
-                    int ArgOff =
-                        -getIndex(Arg, ValueOffsetMap, ValueOffsetCounter);
-                    FuncInstBufferStream << "\tLDR\t\tR" << i << ", R5, #"
-                                         << ArgOff << "\n";
-                  }
-                }
+              // The arguments are never kept in R0-R4 across the call, so
+              // they can be loaded in any order.
+              for (unsigned i = 0; i < CallI->arg_size(); i++) {
+                LoadReg(CallI->getArgOperand(i), i);
+              }
+              Body.emit("JSR", {CalledFuncName.str()});
+              if (StaticFrameWords.count(Func)) {
+                Body.emitMark(FrameBaseMark);
+                CallsStaticFrame = true;
               }
-              FuncInstBufferStream << "\tJSR\t\t" << CalledFuncName << "\n";
               if (!CallI->getType()->isVoidTy()) {
-                if (int ResID = addImmidiate(&I, ImmBufferStream, ImmFlag,
-                                             ImmIDMap, ImmIDCounter)) {
-                  FuncInstBufferStream << "\tST\t\tR0, VALUE_" << ResID << "\n";
-                } else {
-                  int ResOff =
-                      -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-                  FuncInstBufferStream << "\tSTR\t\tR0, R5, #" << ResOff
-                                       << "\n";
-                }
+                StoreReg(&I, 0);
               }
             } else {
               return UnsupportInst(I);
@@ -881,208 +2743,570 @@ PreservedAnalyses LLVMIRToLC3Pass::run(Module &M, ModuleAnalysisManager &MAM) {
           }
         } else if (auto *AllocaI = dyn_cast<AllocaInst>(&I)) {
           continue;
-        } else if (auto *PHIN = dyn_cast<PHINode>(&I)) {
-          int ResOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
-          FuncInstBufferStream << "\tNOT\t\tR0, R7\n"
-                               << "\tADD\t\tR0, R0, #1\n";
-          int ArgSize = PHIN->getNumIncomingValues();
-          int EndLableID = TempLabelCounter + ArgSize;
-          for (unsigned int i = 0; i < ArgSize; ++i) {
-
-            BasicBlock *SrcBB = PHIN->getIncomingBlock(i);
-            std::string SrcBBName = getIndex(SrcBB, BBNameMap, BBNameCounter);
-
-            ++TempLabelCounter;
-            if (i < ArgSize - 1) {
-              FuncInstBufferStream << "\tLEA\t\tR1, " << SrcBBName << "\n"
-                                   << "\tADD\t\tR1, R1, R0\n"
-                                   << "\tBRnp\tPHI_NEXT_" << TempLabelCounter
-                                   << "\n";
-            }
-
-            Value *Val = PHIN->getIncomingValue(i);
-            if (int ValID = addImmidiate(Val, ImmBufferStream, ImmFlag,
-                                         ImmIDMap, ImmIDCounter)) {
-              FuncInstBufferStream << "\tLD\t\tR1, VALUE_" << ValID << "\n";
-            } else {
-              int ValOff = -getIndex(Val, ValueOffsetMap, ValueOffsetCounter);
-              FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << ValOff << "\n";
-            }
-
-            FuncInstBufferStream << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
-            if (i < ArgSize - 1) {
-              FuncInstBufferStream << "\tBR\t\tPHI_NEXT_" << EndLableID << "\n";
-            }
-            FuncInstBufferStream << "PHI_NEXT_" << TempLabelCounter << "\n";
-          }
+        } else if (isa<PHINode>(&I)) {
+          // Written on the incoming edges.
+          continue;
         } else if (auto *RetI = dyn_cast<ReturnInst>(&I)) {
-          bool hasRetVal = false;
           if (Value *Val = RetI->getReturnValue()) {
-            hasRetVal = true;
-            if (int ValID = addImmidiate(Val, ImmBufferStream, ImmFlag,
-                                         ImmIDMap, ImmIDCounter)) {
-              FuncInstBufferStream << "\tLD\t\tR0, VALUE_" << ValID << "\n";
-            } else {
-              int ValOff = -getIndex(Val, ValueOffsetMap, ValueOffsetCounter);
-              FuncInstBufferStream << "\tLDR\t\tR0, R5, #" << ValOff << "\n";
-            }
-          }
-          if (!NoComment) {
-            FuncInstBufferStream << ";\trestore registers\n";
-          }
-          FuncInstBufferStream << "\tADD\t\tR6, R5, #0\n"
-                               << "\tLDR\t\tR5, R6, #0\n"
-                               << "\tLDR\t\tR7, R6, #1\n"
-                               << "\tLDR\t\tR4, R6, #2\n"
-                               << "\tLDR\t\tR3, R6, #3\n"
-                               << "\tLDR\t\tR2, R6, #4\n"
-                               << "\tLDR\t\tR1, R6, #5\n"
-                               << "\tADD\t\tR6, R6, #7\n";
-          if (!hasRetVal) {
-            FuncInstBufferStream << "\tLDR\t\tR0, R6, #-1\n";
+            LoadReg(Val, 0);
           }
-          FuncInstBufferStream << "\tRET\n";
+          Body.emitMark(RetI == EpilogueRet ? EpilogueMark : ReturnMark);
           continue;
         } else if (auto *CastI = dyn_cast<CastInst>(&I)) {
-          int ResOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
-          Value *Op = CastI->getOperand(0);
-          int OpOff = -getIndex(Op, ValueOffsetMap, ValueOffsetCounter);
-
-          FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << OpOff << "\n"
-                               << "\tSTR\t\tR1, R5, #" << ResOff << "\n";
+          StoreReg(&I, UseReg(CastI->getOperand(0)));
         } else if (auto *SelI = dyn_cast<SelectInst>(&I)) {
-          int ResOff = -getIndex(&I, ValueOffsetMap, ValueOffsetCounter);
-
           Value *Cond = SelI->getCondition();
-          int CondOff = -getIndex(Cond, ValueOffsetMap, ValueOffsetCounter);
-
           Value *IfTrue = SelI->getTrueValue();
-          if (int IfTrueID = addImmidiate(IfTrue, ImmBufferStream, ImmFlag,
-                                          ImmIDMap, ImmIDCounter)) {
-            FuncInstBufferStream << "\tLD\t\tR2, VALUE_" << IfTrueID << "\n";
-          } else {
-            int IfTrueOff =
-                -getIndex(IfTrue, ValueOffsetMap, ValueOffsetCounter);
-            FuncInstBufferStream << "\tLDR\t\tR2, R5, #" << IfTrueOff << "\n";
-          }
-
-          FuncInstBufferStream << "\tLDR\t\tR1, R5, #" << CondOff << "\n"
-                               << "\tBRp\t\tSELECT_END_" << ++TempLabelCounter
-                               << "\n";
-
           Value *IfFalse = SelI->getFalseValue();
-          if (int IfFalseID = addImmidiate(IfFalse, ImmBufferStream, ImmFlag,
-                                           ImmIDMap, ImmIDCounter)) {
-            FuncInstBufferStream << "\tLD\t\tR2, VALUE_" << IfFalseID << "\n";
-          } else {
-            int IfFalseOff =
-                -getIndex(IfFalse, ValueOffsetMap, ValueOffsetCounter);
-            FuncInstBufferStream << "\tLDR\t\tR2, R5, #" << IfFalseOff << "\n";
+
+          // The true value is written first, so the result must not
+          // overwrite the condition or the false value.
+          int ResReg = RegAlloc.getReg(&I);
+          if (ResReg < 0 || ResReg == RegAlloc.getReg(Cond) ||
+              ResReg == RegAlloc.getReg(IfFalse)) {
+            ResReg = GetScratch();
           }
 
-          FuncInstBufferStream << "SELECT_END_" << TempLabelCounter << "\n"
-                               << "\tSTR\t\tR2, R5, #" << ResOff << "\n";
+          LoadReg(IfTrue, ResReg);
+          TestReg(Cond);
+          Body.emitBranch("p", "SELECT_END_" + Twine(++TempLabelCounter));
+          LoadReg(IfFalse, ResReg);
+          Body.emitLabel("SELECT_END_" + Twine(TempLabelCounter));
+          StoreReg(&I, ResReg);
         } else if (auto *SwitchI = dyn_cast<SwitchInst>(&I)) {
-          Value *Cond = SwitchI->getCondition();
-          int CondOff = -getIndex(Cond, ValueOffsetMap, ValueOffsetCounter);
-
           BasicBlock *DefaultBB = SwitchI->getDefaultDest();
           std::string DefaultBBName =
               getIndex(DefaultBB, BBNameMap, BBNameCounter);
 
-          FuncInstBufferStream << "\tLEA\t\tR7, " << BBName << "\n"
-                               << "\tLDR\t\tR1, R5, #" << CondOff << "\n";
-
-          bool isFirstCase = true;
+          SmallVector<std::pair<int64_t, BasicBlock *>, 16> Cases;
           for (auto Case : SwitchI->cases()) {
-            ConstantInt *Val = Case.getCaseValue();
-            int ValID = addImmidiate(Val, ImmBufferStream, ImmFlag, ImmIDMap,
-                                     ImmIDCounter);
+            Cases.push_back({Case.getCaseValue()->getSExtValue(),
+                             Case.getCaseSuccessor()});
+          }
+          llvm::sort(Cases, less_first());
+
+          // With a profile, the cases taken at least a third of the times
+          // are compared first, the most frequent first, and the search
+          // leaves them out. The last cases searched are compared from the
+          // most frequent too.
+          std::map<int64_t, uint64_t> CaseWeights;
+          SmallVector<std::pair<uint64_t, int64_t>, 2> HotCases;
+          if (HasProfile) {
+            uint64_t Total = 0;
+            for (unsigned Idx = 0; Idx < SwitchI->getNumSuccessors(); Idx++) {
+              auto Weight = SwitchInstProfUpdateWrapper::getSuccessorWeight(
+                  *SwitchI, Idx);
+              Total += Weight ? *Weight : 0;
+            }
+            for (auto Case : SwitchI->cases()) {
+              auto Weight = SwitchInstProfUpdateWrapper::getSuccessorWeight(
+                  *SwitchI, Case.getSuccessorIndex());
+              int64_t Val = Case.getCaseValue()->getSExtValue();
+              CaseWeights[Val] = Weight ? *Weight : 0;
+              if (Total && CaseWeights[Val] * 3 >= Total) {
+                HotCases.push_back({CaseWeights[Val], Val});
+              }
+            }
+            llvm::sort(HotCases, std::greater<>());
+          }
 
-            BasicBlock *DesBB = Case.getCaseSuccessor();
-            std::string DesBBName = getIndex(DesBB, BBNameMap, BBNameCounter);
+          LoadReg(SwitchI->getCondition(), 1);
 
-            if (dyn_cast<ConstantInt>(Val)->getSExtValue() == 0) {
-              if (!isFirstCase) {
-                FuncInstBufferStream << "\tADD\t\tR1, R1, #0";
+          // Sets the condition codes to the sign of R1 - Val, in R2 unless
+          // Val is 0.
+          bool IsR1CC = true;
+          auto EmitCompare = [&](int64_t Val) {
+            if (Val == 0) {
+              if (!IsR1CC) {
+                Body.emit("ADD", {"R1", "R1", "#0"});
               }
-              FuncInstBufferStream << "\tBRz\t\t" << DesBBName << "\n";
+              IsR1CC = true;
+            } else if (Val >= -15 && Val <= 16) {
+              Body.emit("ADD", {"R2", "R1", immOp(-Val)});
+              IsR1CC = false;
             } else {
-              FuncInstBufferStream << "\tLD\t\tR2, VALUE_" << ValID << "\n"
-                                   << "\tADD\t\tR2, R1, R2\n"
-                                   << "\tBRz\t\t" << DesBBName << "\n";
+              Body.emit("LD", {"R2", Pool.addFill(-Val)});
+              Body.emit("ADD", {"R2", "R1", "R2"});
+              IsR1CC = false;
+            }
+          };
+
+          // Dense switches jump through a table of the block addresses,
+          // indexed by the condition minus the smallest case. The others
+          // search the sorted cases, comparing with the middle one until a
+          // few are left.
+          for (auto &HotCase : HotCases) {
+            auto Case = find_if(Cases, [&](auto &Case) {
+              return Case.first == HotCase.second;
+            });
+            EmitCompare(Case->first);
+            Body.emitBranch("z",
+                            getIndex(Case->second, BBNameMap, BBNameCounter));
+          }
+          int64_t NumCases = Cases.size();
+          int64_t Range = Cases.empty()
+                              ? 0
+                              : Cases.back().first - Cases.front().first + 1;
+          if (NumCases >= 4 && NumCases * 10 >= Range * 4) {
+            int64_t Min = Cases.front().first;
+            if (Min < -15 || Min > 16) {
+              Body.emit("LD", {"R2", Pool.addFill(-Min)});
+              Body.emit("ADD", {"R1", "R1", "R2"});
+            } else if (Min) {
+              Body.emit("ADD", {"R1", "R1", immOp(-Min)});
+            } else {
+              // A hot case compared may have left the codes of R2.
+              EmitCompare(0);
+            }
+            Body.emitBranch("n", DefaultBBName);
+            EmitCompare(Range);
+            Body.emitBranch("zp", DefaultBBName);
+            std::string Table =
+                "SWITCH_TABLE_" + std::to_string(++TempLabelCounter);
+            Body.emit("LEA", {"R2", Table});
+            Body.emit("ADD", {"R2", "R2", "R1"});
+            Body.emit("LDR", {"R2", "R2", "#0"});
+            Body.emit("JMP", {"R2"});
+            size_t From = Body.size();
+            Body.emitLabel(Table);
+            auto Case = Cases.begin();
+            for (int64_t Val = Cases.front().first; Case != Cases.end();
+                 Val++) {
+              BasicBlock *DesBB = DefaultBB;
+              if (Case->first == Val) {
+                DesBB = Case->second;
+                ++Case;
+              }
+              Body.emit(".FILL", {getIndex(DesBB, BBNameMap, BBNameCounter)});
+            }
+            Body.pin(From);
+          } else {
+            // A case matched is at most Range away from the middle one, the
+            // differences must not overflow.
+            size_t SearchCases = Range <= INT16_MAX ? 3 : NumCases;
+            erase_if(Cases, [&](auto &Case) {
+              return any_of(HotCases, [&](auto &HotCase) {
+                return HotCase.second == Case.first;
+              });
+            });
+            // Ranges of the cases left, with the label they start at.
+            SmallVector<std::tuple<size_t, size_t, int>, 8> Pending = {
+                {0, Cases.size(), 0}};
+            while (!Pending.empty()) {
+              auto [Lo, Hi, Label] = Pending.pop_back_val();
+              if (Label) {
+                Body.emitLabel("SWITCH_LEFT_" + Twine(Label));
+                IsR1CC = false;
+              }
+              while (Hi - Lo > SearchCases) {
+                size_t Mid = (Lo + Hi) / 2;
+                EmitCompare(Cases[Mid].first);
+                Body.emitBranch(
+                    "z", getIndex(Cases[Mid].second, BBNameMap, BBNameCounter));
+                Body.emitBranch("n",
+                                "SWITCH_LEFT_" + Twine(++TempLabelCounter));
+                Pending.push_back({Lo, Mid, TempLabelCounter});
+                Lo = Mid + 1;
+              }
+              SmallVector<std::pair<int64_t, BasicBlock *>, 4> Last(
+                  Cases.begin() + Lo, Cases.begin() + Hi);
+              llvm::stable_sort(Last, [&](auto &A, auto &B) {
+                return CaseWeights[A.first] > CaseWeights[B.first];
+              });
+              for (auto &Case : Last) {
+                EmitCompare(Case.first);
+                Body.emitBranch(
+                    "z", getIndex(Case.second, BBNameMap, BBNameCounter));
+              }
+              if (!Pending.empty() || DefaultBB != NextBB) {
+                Body.emitBranch("", DefaultBBName);
+              }
             }
-
-            isFirstCase = false;
           }
-          FuncInstBufferStream << "\tBR\t\t" << DefaultBBName << "\n";
         } else {
           return UnsupportInst(I);
         }
+        RestoreScavenged();
       }
+      Body.setSource(nullptr);
 
-      FuncInstBufferStream << "\n";
-      if (!ImmBuffer.empty()) {
-        if (!NoComment) {
-          FuncInstBufferStream << ";\tconstant section for " << BBName << "\n";
+      Body.emitBlank();
+    }
+
+    // Move the arguments from R0-R4 to where the allocator put them. The
+    // frame slots are written first, the register copies may overwrite an
+    // argument register.
+    LC3Code Args;
+    SmallVector<std::pair<int, int>, 5> ArgCopies;
+    for (unsigned i = 0; i < F.arg_size(); i++) {
+      Value *Arg = F.getArg(i);
+      if (Arg->use_empty()) {
+        continue;
+      }
+      if (int Reg = RegAlloc.getReg(Arg); Reg >= 0) {
+        ArgCopies.push_back({Reg, i});
+      } else {
+        // R7 is saved already and free to address far slots.
+        int ArgSlot = getIndex(Arg, ValueOffsetMap, ValueOffsetCounter);
+        emitFrameAccess("STR", i, ArgSlot, FrameSize, 7, Args);
+        if (getFrameAccessCost(ArgSlot, FrameSize)) {
+          WrittenRegs |= 1u << 7;
         }
-        FuncInstBufferStream << ImmBufferStream.str() << "\n";
       }
     }
-    if (!NoComment) {
-      InstBufferStream << ";\tfunction " << FuncName << "\n";
-      InstBufferStream << ";\targument count: " << F.arg_size() << "\n";
-      InstBufferStream << ";\tlocal variable count: " << ValueOffsetCounter
-                       << "\n";
+    WrittenRegs |=
+        emitParallelCopies(ArgCopies, RegAlloc.getBusyRegs(0), Args);
+    assert((!FrameSize || ValueOffsetCounter == FrameSize) &&
+           "a slot was added to a frame laid out already");
+
+    // The callers keep nothing in R0, R7 and the argument registers across
+    // a call, see getClobberedRegs, but R7 holds the return address. R5 is
+    // only set up when the function has a frame, or overwritten by a call of
+    // a function with a static frame. A static frame holds the saved
+    // registers above the slots and R5 is not preserved, the callers set it
+    // back themselves.
+    bool HasFrame = ValueOffsetCounter;
+    unsigned SavedRegs = WrittenRegs & ~((1u << F.arg_size()) - 1) & 0x9E;
+    if ((HasFrame || CallsStaticFrame) && !IsStatic) {
+      SavedRegs |= 1u << 5;
     }
-    InstBufferStream << FuncName << "\n";
-    InstBufferStream << FuncLabelMap[&F] << "\n";
-    if (!NoComment) {
-      InstBufferStream << ";\tinit R6, R5, save old registers\n";
-    }
-    InstBufferStream << "\tADD\t\tR6, R6, #-7\n"
-                     << "\tSTR\t\tR0, R6, #6\n"
-                     << "\tSTR\t\tR1, R6, #5\n"
-                     << "\tSTR\t\tR2, R6, #4\n"
-                     << "\tSTR\t\tR3, R6, #3\n"
-                     << "\tSTR\t\tR4, R6, #2\n"
-                     << "\tSTR\t\tR7, R6, #1\n"
-                     << "\tSTR\t\tR5, R6, #0\n"
-                     << "\tADD\t\tR5, R6, #0\n";
-    if (ValueOffsetCounter <= 32) {
-      if (ValueOffsetCounter > 16) {
-        InstBufferStream << "\tADD\t\tR6, R6, #-16\n";
-        ValueOffsetCounter -= 16;
-      }
-      if (ValueOffsetCounter) {
-        InstBufferStream << "\tADD\t\tR6, R6, #-" << ValueOffsetCounter << "\n";
+    SmallVector<int, 6> SavedOrder;
+    for (int Reg : {1, 2, 3, 4, 7, 5}) {
+      if (SavedRegs & (1u << Reg)) {
+        SavedOrder.push_back(Reg);
+      }
+    }
+    int NumSaved = SavedOrder.size();
+    IsStatic = IsStatic && (HasFrame || NumSaved);
+
+    // Sets R5 to the frame after a call of a function with a static frame.
+    // On the stack, R5 is R6 plus the size of the frame after the prologue.
+    // Static frames without slots only need it for the epilogue.
+    LC3Code FrameBase;
+    if (IsStatic) {
+      StaticFrameWords[&F] = {ValueOffsetCounter, NumSaved};
+      FrameBase.emit("LD", {"R5", Pool.addAddress(GetFrameLabel(&F))});
+    } else if (HasFrame) {
+      for (int Size = ValueOffsetCounter, Base = 6; Size;
+           Size -= std::min(Size, 15), Base = 5) {
+        FrameBase.emit("ADD", {"R5", regOp(Base), immOp(std::min(Size, 15))});
+      }
+    }
+
+    LC3Code Restore;
+    if (!NoComment && (HasFrame || NumSaved)) {
+      Restore.emitComment("\trestore registers");
+    }
+    if (IsStatic) {
+      if (!HasFrame && CallsStaticFrame) {
+        Restore.append(FrameBase);
+      }
+      for (int i = NumSaved - 1; i >= 0; i--) {
+        Restore.emit("LDR", {regOp(SavedOrder[i]), "R5", immOp(i)});
       }
     } else {
-      errs() << "Too many local variables: " << ValueOffsetCounter << "\n"
-             << "No file generated.\n";
-      return PreservedAnalyses::none();
+      if (HasFrame) {
+        Restore.emit("ADD", {"R6", "R5", "#0"});
+      }
+      for (int i = NumSaved - 1; i >= 0; i--) {
+        Restore.emit("LDR",
+                     {regOp(SavedOrder[i]), "R6", immOp(NumSaved - 1 - i)});
+      }
+      if (NumSaved) {
+        Restore.emit("ADD", {"R6", "R6", immOp(NumSaved)});
+      }
+    }
+    LC3Code Epilogue;
+    LC3Code Return;
+    // A lone RET is not worth a branch.
+    if (HasFrame || NumSaved) {
+      Epilogue.emitLabel(EpilogueLabel);
+      Return.emitBranch("", EpilogueLabel);
     }
-    if (int argSize = F.arg_size()) {
+    Epilogue.append(Restore);
+    Epilogue.emit("RET");
+    if (Return.empty()) {
+      Return = Epilogue;
+    }
+    Body.replaceMarks(EpilogueMark, Epilogue);
+    Body.replaceMarks(ReturnMark, Return);
+    Body.replaceMarks(RestoreMark, Restore);
+    Body.replaceMarks(FrameBaseMark, HasFrame ? FrameBase : LC3Code());
+
+    LC3Code Func;
+    if (!NoComment) {
+      Func.emitComment("\tfunction " + FuncName);
+      Func.emitComment("\targument count: " + Twine(F.arg_size()));
+      Func.emitComment("\tlocal variable count: " +
+                       Twine(ValueOffsetCounter));
+      bool isFirstReg = true;
+      for (auto &Interval : RegAlloc.getIntervals()) {
+        if (Interval.Reg >= 0) {
+          if (isFirstReg) {
+            Func.emitComment("\tregister allocation:");
+            isFirstReg = false;
+          }
+          Func.emitComment("\t\t" + getValueName(Interval.Val) + ": R" +
+                           Twine(Interval.Reg));
+        }
+      }
+    }
+    Func.emitLabel(FuncName);
+    Func.emitLabel(FuncLabelMap[&F]);
+    if (IsStatic) {
       if (!NoComment) {
-        InstBufferStream << ";\tstore arguments\n";
+        Func.emitComment("\tinit R5 to the static frame, save old registers");
+      }
+      Func.append(FrameBase);
+      for (int i = 0; i < NumSaved; i++) {
+        Func.emit("STR", {regOp(SavedOrder[i]), "R5", immOp(i)});
       }
-      for (int i = 0; i < argSize; i++) {
-        Value *Arg = F.getArg(i);
-        int ArgOff = -getIndex(Arg, ValueOffsetMap, ValueOffsetCounter);
-        InstBufferStream << "\tSTR\t\tR" << i << ", R5, #" << ArgOff << "\n";
+    } else {
+      if (!NoComment && (HasFrame || NumSaved)) {
+        Func.emitComment("\tinit R6, R5, save old registers");
+      }
+      if (NumSaved) {
+        Func.emit("ADD", {"R6", "R6", immOp(-NumSaved)});
+      }
+      for (int i = 0; i < NumSaved; i++) {
+        Func.emit("STR", {regOp(SavedOrder[i]), "R6", immOp(NumSaved - 1 - i)});
+      }
+      if (HasFrame) {
+        Func.emit("ADD", {"R5", "R6", "#0"});
+      }
+      for (int Size = ValueOffsetCounter; Size; Size -= std::min(Size, 16)) {
+        Func.emit("ADD", {"R6", "R6", immOp(-std::min(Size, 16))});
+      }
+    }
+    if (!TailCallLabel.empty()) {
+      Func.emitLabel(TailCallLabel);
+    }
+    if (!Args.empty()) {
+      if (!NoComment) {
+        Func.emitComment("\tstore arguments");
       }
+      Func.append(Args);
     }
 
-    InstBufferStream << FuncInstBufferStream.str();
+    Func.append(Body);
+    if (!NoPeephole) {
+      Peephole.run(Func);
+    }
+    size_t FuncBegin = Program.size();
+    if (HasProfile) {
+      Pool.layout(Func, Program, NoComment, [&](const LC3MachineInst &MI) {
+        return MI.Source
+                   ? BFI.getBlockFreq(MI.Source->getParent()).getFrequency()
+                   : 0;
+      });
+    } else {
+      Pool.layout(Func, Program, NoComment);
+    }
+    if (EmitBounds) {
+      // A frame on the stack holds the saved registers, then the slots.
+      // The counters borrow the word below the stack.
+      LC3Bounds &Bounds = FuncBounds[&F];
+      Bounds.FrameWords =
+          (IsStatic ? 0 : NumSaved + ValueOffsetCounter) + Instrument;
+      StringMap<const BasicBlock *> Labels;
+      for (auto &BB : F) {
+        if (auto It = BBNameMap.find(&BB); It != BBNameMap.end()) {
+          Labels[It->second] = &BB;
+        }
+      }
+      Labels[EpilogueLabel] = nullptr;
+      addBlockCycles(ArrayRef(Program.getInsts()).drop_front(FuncBegin),
+                     &F.getEntryBlock(), Labels, Bounds.BlockCycles);
+    }
+  }
+  if (Instrument) {
+    Pool.startBlock();
+    LC3Code Dump;
+    emitDumpCounters(Counters.size(), Pool, Dump, NoComment);
+    Pool.layout(Dump, Program, NoComment);
   }
 
-  Out.os() << InstBufferStream.str() << "\t.END";
+  // Frames of functions that can be active at the same time, one calling
+  // the other maybe through others, must not overlap. Each frame goes after
+  // the ones of all the functions reaching it in the call graph.
+  DenseMap<Function *, int> FrameStart;
+  std::vector<std::pair<int, Function *>> FrameBases;
+  int StaticWords = 0;
+  int StaticEnd = 0;
+  for (auto &SCC : SCCs) {
+    int Start = 0;
+    for (CallGraphNode *Node : SCC) {
+      Start = std::max(Start, FrameStart.lookup(Node->getFunction()));
+    }
+    int End = Start;
+    if (auto It = StaticFrameWords.find(SCC.front()->getFunction());
+        It != StaticFrameWords.end()) {
+      FrameBases.push_back({Start + It->second.first, It->first});
+      End += It->second.first + It->second.second;
+      StaticWords += It->second.first + It->second.second;
+      StaticEnd = std::max(StaticEnd, End);
+    }
+    for (CallGraphNode *Node : SCC) {
+      for (auto &Call : *Node) {
+        Function *Callee = Call.second->getFunction();
+        if (Callee && !is_contained(SCC, Call.second)) {
+          FrameStart[Callee] = std::max(FrameStart.lookup(Callee), End);
+        }
+      }
+    }
+  }
+  if (StaticEnd) {
+    llvm::sort(FrameBases);
+    if (!NoComment) {
+      Program.emitComment("\tstatic frames");
+    }
+    int Pos = 0;
+    for (auto &Base : FrameBases) {
+      if (Base.first > Pos) {
+        Program.emit(".BLKW", {immOp(Base.first - Pos)});
+        Pos = Base.first;
+      }
+      Program.emitLabel(GetFrameLabel(Base.second));
+    }
+    if (StaticEnd > Pos) {
+      Program.emit(".BLKW", {immOp(StaticEnd - Pos)});
+    }
+    Program.emitBlank();
+  }
+  if (Instrument) {
+    if (!NoComment) {
+      Program.emitComment("\tblock counters");
+    }
+    Program.emitLabel("LC3_COUNTERS");
+    for (auto &Counter : Counters) {
+      Program.emitLabel("COUNT_" + std::get<1>(Counter));
+      Program.emit(".BLKW", {"#1"});
+    }
+    Program.emitBlank();
+  }
+  Program.emit(".END");
+  printLC3(Program.getInsts(), Out.os());
 
   Out.keep();
 
   errs() << "One file generated: " << TargetFileName << "\n";
+  errs() << "Constant pool: " << Pool.getPoolWords() << " words in "
+         << Pool.getNumIslands() << " islands, "
+         << Pool.getBlockPoolWords() - Pool.getPoolWords()
+         << " words saved over one pool per block\n";
+  if (!NoPeephole) {
+    errs() << "Peephole: " << Peephole.getNumLoads() << " loads, "
+           << Peephole.getNumStores() << " stores, "
+           << Peephole.getNumNegations() << " negations removed, "
+           << Peephole.getNumBranches() << " branches simplified\n";
+  }
+  if (StaticEnd) {
+    errs() << "Static frames: " << StaticEnd << " words for "
+           << FrameBases.size() << " functions, " << StaticWords - StaticEnd
+           << " words saved by overlaying them\n";
+  }
+  std::string Stem = sys::path::stem(SourceFileName).str();
+  if (Instrument) {
+    ToolOutputFile CountersFile(Stem + ".counters", EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return PreservedAnalyses::none();
+    }
+    for (auto &[Func, Label, Block] : Counters) {
+      CountersFile.os() << Func << "\t" << Label << "\t" << Block << "\n";
+    }
+    CountersFile.keep();
+    errs() << "Instrumented " << Counters.size()
+           << " blocks, counters listed in " << Stem << ".counters\n";
+  }
+
+  Function *Main = HasMain ? M.getFunction("main") : nullptr;
+  if (EmitBounds) {
+    computeBounds(CG, FAM, StaticFuncs, TripCounts, FuncBounds);
+    ToolOutputFile BoundsFile(Stem + ".bounds", EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return PreservedAnalyses::none();
+    }
+    writeBounds(M, FuncBounds, BoundsFile.os());
+    BoundsFile.keep();
+    errs() << "Worst-case bounds of " << FuncBounds.size()
+           << " functions written to " << Stem << ".bounds\n";
+  }
+
+  // The stack is checked against the program once assembled.
+  if (!EmitObject && !EmitMap && !(EmitBounds && Main)) {
+    return PreservedAnalyses::none();
+  }
+  LC3Assembler Assembler;
+  if (!Assembler.assemble(Program.getInsts(), TargetFileName)) {
+    if (EmitObject || EmitMap) {
+      errs() << "No " << (EmitObject ? "object" : "map")
+             << " file generated\n";
+    }
+    return PreservedAnalyses::none();
+  }
+  if (EmitObject) {
+    ToolOutputFile Obj(Stem + ".obj", EC, sys::fs::OF_None);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return PreservedAnalyses::none();
+    }
+    ToolOutputFile Sym(Stem + ".sym", EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return PreservedAnalyses::none();
+    }
+    Assembler.writeObject(Obj.os());
+    Assembler.writeSymbols(Sym.os());
+    Obj.keep();
+    Sym.keep();
+    errs() << "Assembled " << Assembler.getNumWords() << " words into "
+           << Stem << ".obj and " << Stem << ".sym\n";
+  }
+  if (EmitMap) {
+    ToolOutputFile Map(Stem + ".map", EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return PreservedAnalyses::none();
+    }
+    StringMap<std::string> BlockLabels;
+    for (auto &[BB, Label] : BBNameMap) {
+      BlockLabels[Label] = getBBName(BB);
+    }
+    writeMap(M, Program.getInsts(), BlockLabels, Assembler, Map.os());
+    Map.keep();
+    errs() << "Address map written to " << Stem << ".map\n";
+  }
+  if (EmitBounds && Main) {
+    // The stack grows down from the base the header loads into R6, for
+    // main then for the routine printing the counters.
+    int Begin = Assembler.getOrigin();
+    int End = Begin + Assembler.getNumWords();
+    int Base = 0;
+    for (auto &[Label, Addr] : Assembler.getSymbols()) {
+      if (Label == "STACK_BASE") {
+        Base = Assembler.getWords()[Addr - Begin];
+      }
+    }
+    Base = Base ? Base : 0x10000;
+    std::optional<int> StackWords = FuncBounds[Main].StackWords;
+    if (StackWords && Instrument) {
+      StackWords = std::max(*StackWords, 7);
+    }
+    if (Base > Begin && (!StackWords || Base - *StackWords < End)) {
+      errs() << "Warning: the stack may grow from "
+             << format("x%04X", Base & 0xFFFF);
+      if (StackWords) {
+        errs() << " down to "
+               << format("x%04X", std::max(Base - *StackWords, 0));
+      } else {
+        errs() << " without a bound";
+      }
+      errs() << " into the program at "
+             << format("x%04X-x%04X", Begin, End - 1) << "\n";
+    }
+  }
 
   return PreservedAnalyses::none();
 }
@@ -0,0 +1,100 @@
+# Compiles the kernels of the benchmark with the pass, runs them in lc3-sim
+# and compares their cycles with the ones in baseline.txt, failing when one
+# takes more than TOLERANCE percent more. With UPDATE set, the cycles are
+# written to baseline.txt instead. A kernel with its IR in bench/<name>.ll
+# runs that IR, the others are compiled with clang.
+#
+# Run through the bench and bench-update targets, which set CLANG, OPT,
+# PASS, SIM, SOURCE_DIR and WORK_DIR.
+
+if(NOT DEFINED TOLERANCE)
+  set(TOLERANCE 1)
+endif()
+set(Baseline ${SOURCE_DIR}/bench/baseline.txt)
+file(GLOB Kernels ${SOURCE_DIR}/bench/*.c)
+list(APPEND Kernels ${SOURCE_DIR}/example.c)
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+if(EXISTS ${Baseline})
+  file(STRINGS ${Baseline} Lines REGEX "^[^#]")
+  foreach(Line ${Lines})
+    if(Line MATCHES "^([^ ]+) +([0-9]+)$")
+      set(Baseline_${CMAKE_MATCH_1} ${CMAKE_MATCH_2})
+    endif()
+  endforeach()
+endif()
+
+set(Results "")
+set(Regressions "")
+foreach(Kernel ${Kernels})
+  get_filename_component(Name ${Kernel} NAME_WE)
+  file(REMOVE ${WORK_DIR}/${Name}.obj)
+  if(EXISTS ${SOURCE_DIR}/bench/${Name}.ll)
+    configure_file(${SOURCE_DIR}/bench/${Name}.ll ${WORK_DIR}/${Name}.ll
+                   COPYONLY)
+  elseif(NOT CLANG)
+    message(FATAL_ERROR "${Name}: no IR in bench/ and no clang to compile it")
+  else()
+    execute_process(
+      COMMAND ${CLANG} -O1 -fno-discard-value-names -S -emit-llvm
+              -I${SOURCE_DIR} ${Kernel} -o ${Name}.ll
+      WORKING_DIRECTORY ${WORK_DIR}
+      RESULT_VARIABLE Failed
+      ERROR_VARIABLE Error)
+    if(Failed)
+      message(FATAL_ERROR "${Name}: compilation failed\n${Error}")
+    endif()
+  endif()
+  execute_process(
+    COMMAND ${OPT} -load-pass-plugin=${PASS} -passes=llvm-ir-to-lc3-pass
+            -lc3-obj -disable-output ${Name}.ll
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE Failed
+    ERROR_VARIABLE Error)
+  if(Failed OR NOT EXISTS ${WORK_DIR}/${Name}.obj)
+    message(FATAL_ERROR "${Name}: translation failed\n${Error}")
+  endif()
+  execute_process(
+    COMMAND ${SIM} ${Name}.obj
+    WORKING_DIRECTORY ${WORK_DIR}
+    RESULT_VARIABLE Failed
+    OUTPUT_VARIABLE Output
+    ERROR_VARIABLE Stats)
+  if(Failed)
+    message(FATAL_ERROR "${Name}: simulation failed\n${Output}${Stats}")
+  endif()
+  foreach(Stat Instructions "Memory reads" "Memory writes" Cycles R0)
+    string(REGEX MATCH "${Stat}: (-?[0-9]+)" _ "${Stats}")
+    string(REPLACE " " "_" Var "${Stat}")
+    set(${Var} ${CMAKE_MATCH_1})
+  endforeach()
+
+  set(Change "no baseline")
+  if(DEFINED Baseline_${Name})
+    set(Old ${Baseline_${Name}})
+    math(EXPR Limit "${Old} + ${Old} * ${TOLERANCE} / 100")
+    math(EXPR Diff "${Cycles} - ${Old}")
+    if(Diff GREATER 0)
+      set(Diff "+${Diff}")
+    endif()
+    set(Change "baseline ${Old}, ${Diff}")
+    if(Cycles GREATER Limit)
+      string(APPEND Change ", REGRESSION")
+      list(APPEND Regressions ${Name})
+    endif()
+  endif()
+  message(STATUS "${Name}: ${Instructions} instructions, ${Memory_reads} "
+                 "reads, ${Memory_writes} writes, ${Cycles} cycles, "
+                 "R0 ${R0} (${Change})")
+  string(APPEND Results "${Name} ${Cycles}\n")
+endforeach()
+
+if(UPDATE)
+  file(WRITE ${Baseline}
+       "# Cycles of the benchmark kernels, written by the bench-update "
+       "target.\n${Results}")
+  message(STATUS "Baseline written to ${Baseline}")
+elseif(Regressions)
+  string(REPLACE ";" ", " Regressions "${Regressions}")
+  message(FATAL_ERROR "Cycle regressions over ${TOLERANCE}%: ${Regressions}")
+endif()
@@ -0,0 +1,48 @@
+#include "LC3.h"
+
+// Division, multiplication and bit operations in small loops. The inputs
+// are read from memory so the compiler can not fold the loops away.
+#define SEED 0x4200
+
+unsigned gcd(unsigned a, unsigned b) {
+  while (b) {
+    unsigned t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+unsigned popcount(unsigned x) {
+  unsigned count = 0;
+  for (; x; x >>= 1) {
+    count += x & 1;
+  }
+  return count;
+}
+
+unsigned isqrt(unsigned x) {
+  unsigned root = 0;
+  while ((root + 1) * (root + 1) <= x) {
+    root++;
+  }
+  return root;
+}
+
+unsigned digits(unsigned x) {
+  unsigned sum = 0;
+  for (; x; x /= 10) {
+    sum += x % 10;
+  }
+  return sum;
+}
+
+int main() {
+  unsigned seed = loadAddr(SEED);
+  unsigned sum = 0;
+  for (unsigned i = 1; i <= 20; i++) {
+    unsigned x = seed + i * 97;
+    sum += gcd(x, i * 12 + 6) + popcount(x) + isqrt(x) + digits(x);
+  }
+  return sum & 0x7FFF;
+}
@@ -0,0 +1,169 @@
+; IR of bench/arith.c as clang -O1 -fno-discard-value-names -S -emit-llvm gives it,
+; kept here so the cycles of the baseline do not move with the version of clang.
+; Regenerate it whenever bench/arith.c changes.
+source_filename = "arith.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @gcd(i32 %a0, i32 %b0) local_unnamed_addr {
+entry:
+  %nz.not1 = icmp eq i32 %b0, 0
+  br i1 %nz.not1, label %end, label %body
+
+body:                                             ; preds = %entry, %body
+  %b3 = phi i32 [ %t, %body ], [ %b0, %entry ]
+  %a2 = phi i32 [ %b3, %body ], [ %a0, %entry ]
+  %t = urem i32 %a2, %b3
+  %nz.not = icmp eq i32 %t, 0
+  br i1 %nz.not, label %end, label %body
+
+end:                                              ; preds = %body, %entry
+  %a.lcssa = phi i32 [ %a0, %entry ], [ %b3, %body ]
+  ret i32 %a.lcssa
+}
+
+define i32 @popcount(i32 %x0) local_unnamed_addr {
+entry:
+  %nz.not1 = icmp eq i32 %x0, 0
+  br i1 %nz.not1, label %end, label %body
+
+body:                                             ; preds = %entry, %body
+  %count3 = phi i32 [ %c2, %body ], [ 0, %entry ]
+  %x2 = phi i32 [ %xs, %body ], [ %x0, %entry ]
+  %bit = and i32 %x2, 1
+  %c2 = add i32 %count3, %bit
+  %xs = lshr i32 %x2, 1
+  %nz.not = icmp ult i32 %x2, 2
+  br i1 %nz.not, label %end, label %body
+
+end:                                              ; preds = %body, %entry
+  %count.lcssa = phi i32 [ 0, %entry ], [ %c2, %body ]
+  ret i32 %count.lcssa
+}
+
+define i32 @isqrt(i32 %x) local_unnamed_addr {
+entry:
+  br label %cond
+
+cond:                                             ; preds = %cond, %entry
+  %root = phi i32 [ 0, %entry ], [ %r1, %cond ]
+  %r1 = add i32 %root, 1
+  %sq = mul i32 %r1, %r1
+  %le.not = icmp ugt i32 %sq, %x
+  br i1 %le.not, label %end, label %cond
+
+end:                                              ; preds = %cond
+  ret i32 %root
+}
+
+define i32 @digits(i32 %x0) local_unnamed_addr {
+entry:
+  %nz.not1 = icmp eq i32 %x0, 0
+  br i1 %nz.not1, label %end, label %body
+
+body:                                             ; preds = %entry, %body
+  %sum3 = phi i32 [ %s2, %body ], [ 0, %entry ]
+  %x2 = phi i32 [ %xd, %body ], [ %x0, %entry ]
+  %d = urem i32 %x2, 10
+  %s2 = add i32 %sum3, %d
+  %xd = udiv i32 %x2, 10
+  %0 = icmp ult i32 %x2, 10
+  br i1 %0, label %end, label %body
+
+end:                                              ; preds = %body, %entry
+  %sum.lcssa = phi i32 [ 0, %entry ], [ %s2, %body ]
+  ret i32 %sum.lcssa
+}
+
+define i32 @main() local_unnamed_addr {
+entry:
+  %seed = call i32 @loadAddr(i32 16896)
+  br label %body
+
+body:                                             ; preds = %entry, %digits.exit
+  %sum7 = phi i32 [ 0, %entry ], [ %s4, %digits.exit ]
+  %i6 = phi i32 [ 1, %entry ], [ %i1, %digits.exit ]
+  %m = mul nuw nsw i32 %i6, 97
+  %x = add i32 %m, %seed
+  %m12 = mul nuw nsw i32 %i6, 12
+  %b = add nuw nsw i32 %m12, 6
+  br label %body.i
+
+body.i:                                           ; preds = %body.i, %body
+  %b3.i = phi i32 [ %t.i, %body.i ], [ %b, %body ]
+  %a2.i = phi i32 [ %b3.i, %body.i ], [ %x, %body ]
+  %t.i = urem i32 %a2.i, %b3.i
+  %nz.not.i = icmp eq i32 %t.i, 0
+  br i1 %nz.not.i, label %gcd.exit, label %body.i
+
+gcd.exit:                                         ; preds = %body.i
+  %nz.not1.i = icmp eq i32 %x, 0
+  br i1 %nz.not1.i, label %popcount.exit, label %body.i2
+
+body.i2:                                          ; preds = %gcd.exit, %body.i2
+  %count3.i = phi i32 [ %c2.i, %body.i2 ], [ 0, %gcd.exit ]
+  %x2.i = phi i32 [ %xs.i, %body.i2 ], [ %x, %gcd.exit ]
+  %bit.i = and i32 %x2.i, 1
+  %c2.i = add i32 %bit.i, %count3.i
+  %xs.i = lshr i32 %x2.i, 1
+  %nz.not.i1 = icmp ult i32 %x2.i, 2
+  br i1 %nz.not.i1, label %popcount.exit, label %body.i2
+
+popcount.exit:                                    ; preds = %body.i2, %gcd.exit
+  %count.lcssa.i = phi i32 [ 0, %gcd.exit ], [ %c2.i, %body.i2 ]
+  br label %cond.i
+
+cond.i:                                           ; preds = %cond.i, %popcount.exit
+  %root.i = phi i32 [ 0, %popcount.exit ], [ %r1.i, %cond.i ]
+  %r1.i = add i32 %root.i, 1
+  %sq.i = mul i32 %r1.i, %r1.i
+  %le.not.i = icmp ugt i32 %sq.i, %x
+  br i1 %le.not.i, label %isqrt.exit, label %cond.i
+
+isqrt.exit:                                       ; preds = %cond.i
+  br i1 %nz.not1.i, label %digits.exit, label %body.i5
+
+body.i5:                                          ; preds = %isqrt.exit, %body.i5
+  %sum3.i = phi i32 [ %s2.i, %body.i5 ], [ 0, %isqrt.exit ]
+  %x2.i4 = phi i32 [ %xd.i, %body.i5 ], [ %x, %isqrt.exit ]
+  %d.i = urem i32 %x2.i4, 10
+  %s2.i = add i32 %d.i, %sum3.i
+  %xd.i = udiv i32 %x2.i4, 10
+  %0 = icmp ult i32 %x2.i4, 10
+  br i1 %0, label %digits.exit, label %body.i5
+
+digits.exit:                                      ; preds = %body.i5, %isqrt.exit
+  %sum.lcssa.i = phi i32 [ 0, %isqrt.exit ], [ %s2.i, %body.i5 ]
+  %s1 = add i32 %b3.i, %sum7
+  %s2 = add i32 %s1, %count.lcssa.i
+  %s3 = add i32 %s2, %root.i
+  %s4 = add i32 %s3, %sum.lcssa.i
+  %i1 = add nuw nsw i32 %i6, 1
+  %exitcond.not = icmp eq i32 %i1, 21
+  br i1 %exitcond.not, label %end, label %body
+
+end:                                              ; preds = %digits.exit
+  %r = and i32 %s4, 32767
+  ret i32 %r
+}
+
+define void @printInt(i32 %x) local_unnamed_addr {
+entry:
+  %big = icmp ugt i32 %x, 10
+  br i1 %big, label %rec, label %out
+
+rec:                                              ; preds = %entry
+  %q = udiv i32 %x, 10
+  call void @printInt(i32 %q)
+  br label %out
+
+out:                                              ; preds = %rec, %entry
+  %r = urem i32 %x, 10
+  %c = or disjoint i32 %r, 48
+  call void @printChar(i32 %c)
+  ret void
+}
+
+declare void @printChar(i32) local_unnamed_addr
+
+declare i32 @loadAddr(i32) local_unnamed_addr
@@ -0,0 +1,54 @@
+; IR of example.c as clang -O1 -fno-discard-value-names -S -emit-llvm gives it,
+; kept here so the cycles of the baseline do not move with the version of clang.
+; Regenerate it whenever example.c changes.
+source_filename = "example.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @f(i32 %a, i32 %b) local_unnamed_addr {
+entry:
+  %0 = mul i32 %a, %b
+  %x = sub i32 0, %0
+  ret i32 %x
+}
+
+define i32 @foo(i32 %x) local_unnamed_addr {
+entry:
+  %pos = icmp sgt i32 %x, 0
+  br i1 %pos, label %t, label %end
+
+t:                                                ; preds = %entry
+  %x1 = add nsw i32 %x, -1
+  %r = call i32 @foo(i32 %x1)
+  %m = mul nsw i32 %r, %x
+  br label %end
+
+end:                                              ; preds = %entry, %t
+  %v = phi i32 [ %m, %t ], [ 1, %entry ]
+  ret i32 %v
+}
+
+define i32 @main() local_unnamed_addr {
+entry:
+  %y = call i32 @foo(i32 7)
+  ret i32 0
+}
+
+define void @printInt(i32 %x) local_unnamed_addr {
+entry:
+  %big = icmp ugt i32 %x, 10
+  br i1 %big, label %rec, label %out
+
+rec:                                              ; preds = %entry
+  %q = udiv i32 %x, 10
+  call void @printInt(i32 %q)
+  br label %out
+
+out:                                              ; preds = %rec, %entry
+  %r = urem i32 %x, 10
+  %c = or disjoint i32 %r, 48
+  call void @printChar(i32 %c)
+  ret void
+}
+
+declare void @printChar(i32) local_unnamed_addr
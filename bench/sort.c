@@ -0,0 +1,35 @@
+#include "LC3.h"
+
+// Insertion sort of pseudo random words. The pass has no arrays, the words
+// are kept at a fixed address.
+#define BASE 0x4000
+#define COUNT 48
+
+unsigned next(unsigned x) { return x * 25173 + 13849; }
+
+int main() {
+  unsigned x = loadAddr(BASE) + 1;
+  for (unsigned i = 0; i < COUNT; i++) {
+    x = next(x);
+    storeAddr(x >> 4, BASE + i);
+  }
+  for (unsigned i = 1; i < COUNT; i++) {
+    unsigned v = loadAddr(BASE + i);
+    unsigned j = i;
+    while (j > 0 && loadAddr(BASE + j - 1) > v) {
+      storeAddr(loadAddr(BASE + j - 1), BASE + j);
+      j--;
+    }
+    storeAddr(v, BASE + j);
+  }
+  unsigned sorted = 1;
+  for (unsigned i = 1; i < COUNT; i++) {
+    if (loadAddr(BASE + i - 1) > loadAddr(BASE + i)) {
+      sorted = 0;
+    }
+  }
+  printStr("sorted: ");
+  printChar('0' + sorted);
+  printChar('\n');
+  return sorted;
+}
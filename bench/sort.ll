@@ -0,0 +1,108 @@
+; IR of bench/sort.c as clang -O1 -fno-discard-value-names -S -emit-llvm gives it,
+; kept here so the cycles of the baseline do not move with the version of clang.
+; Regenerate it whenever bench/sort.c changes.
+source_filename = "sort.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+@.str = private unnamed_addr constant [9 x i8] c"sorted: \00"
+
+define i32 @next(i32 %x) local_unnamed_addr {
+entry:
+  %m = mul i32 %x, 25173
+  %r = add i32 %m, 13849
+  ret i32 %r
+}
+
+define i32 @main() local_unnamed_addr {
+entry:
+  %l = call i32 @loadAddr(i32 16384)
+  %x0 = add i32 %l, 1
+  br label %fill.body
+
+fill.body:                                        ; preds = %entry, %fill.body
+  %i2 = phi i32 [ 0, %entry ], [ %i1, %fill.body ]
+  %x1 = phi i32 [ %x0, %entry ], [ %r.i, %fill.body ]
+  %m.i = mul i32 %x1, 25173
+  %r.i = add i32 %m.i, 13849
+  %sh = lshr i32 %r.i, 4
+  %a = add nuw nsw i32 %i2, 16384
+  call void @storeAddr(i32 %sh, i32 %a)
+  %i1 = add nuw nsw i32 %i2, 1
+  %exitcond.not = icmp eq i32 %i1, 48
+  br i1 %exitcond.not, label %sort.body, label %fill.body
+
+sort.body:                                        ; preds = %fill.body, %while.end
+  %si6 = phi i32 [ %si1, %while.end ], [ 1, %fill.body ]
+  %va = add nuw nsw i32 %si6, 16384
+  %v = call i32 @loadAddr(i32 %va)
+  br label %land
+
+land:                                             ; preds = %sort.body, %while.body
+  %j4 = phi i32 [ %j1, %while.body ], [ %si6, %sort.body ]
+  %pa1 = add nuw nsw i32 %j4, 16383
+  %pv = call i32 @loadAddr(i32 %pa1)
+  %gt = icmp ugt i32 %pv, %v
+  br i1 %gt, label %while.body, label %while.end
+
+while.body:                                       ; preds = %land
+  %pa = add nuw nsw i32 %j4, 16384
+  %qv = call i32 @loadAddr(i32 %pa1)
+  call void @storeAddr(i32 %qv, i32 %pa)
+  %j1 = add nsw i32 %j4, -1
+  %jpos.not = icmp eq i32 %j1, 0
+  br i1 %jpos.not, label %while.end, label %land
+
+while.end:                                        ; preds = %while.body, %land
+  %j.lcssa.ph = phi i32 [ 0, %while.body ], [ %j4, %land ]
+  %ea = add i32 %j.lcssa.ph, 16384
+  call void @storeAddr(i32 %v, i32 %ea)
+  %si1 = add nuw nsw i32 %si6, 1
+  %exitcond10.not = icmp eq i32 %si1, 48
+  br i1 %exitcond10.not, label %check.body, label %sort.body
+
+check.body:                                       ; preds = %while.end, %check.body
+  %sorted9 = phi i32 [ %spec.select, %check.body ], [ 1, %while.end ]
+  %ci8 = phi i32 [ %ci1, %check.body ], [ 1, %while.end ]
+  %ba = add nuw nsw i32 %ci8, 16384
+  %ba1 = add nuw nsw i32 %ci8, 16383
+  %bv = call i32 @loadAddr(i32 %ba1)
+  %cv = call i32 @loadAddr(i32 %ba)
+  %cgt = icmp ugt i32 %bv, %cv
+  %spec.select = select i1 %cgt, i32 0, i32 %sorted9
+  %ci1 = add nuw nsw i32 %ci8, 1
+  %exitcond11.not = icmp eq i32 %ci1, 48
+  br i1 %exitcond11.not, label %done, label %check.body
+
+done:                                             ; preds = %check.body
+  call void @printStr(ptr nonnull @.str)
+  %ch = add i32 %spec.select, 48
+  call void @printChar(i32 %ch)
+  call void @printChar(i32 10)
+  ret i32 %spec.select
+}
+
+define void @printInt(i32 %x) local_unnamed_addr {
+entry:
+  %big = icmp ugt i32 %x, 10
+  br i1 %big, label %rec, label %out
+
+rec:                                              ; preds = %entry
+  %q = udiv i32 %x, 10
+  call void @printInt(i32 %q)
+  br label %out
+
+out:                                              ; preds = %rec, %entry
+  %r = urem i32 %x, 10
+  %c = or disjoint i32 %r, 48
+  call void @printChar(i32 %c)
+  ret void
+}
+
+declare void @printStr(ptr) local_unnamed_addr
+
+declare void @printChar(i32) local_unnamed_addr
+
+declare i32 @loadAddr(i32) local_unnamed_addr
+
+declare void @storeAddr(i32, i32) local_unnamed_addr
@@ -0,0 +1,43 @@
+#include "LC3.h"
+
+// Length, reversal and case conversion of a zero terminated string kept at
+// a fixed address.
+#define BUF 0x4100
+
+unsigned length(unsigned str) {
+  unsigned len = 0;
+  while (loadAddr(str + len)) {
+    len++;
+  }
+  return len;
+}
+
+void reverse(unsigned str, unsigned len) {
+  for (unsigned i = 0, j = len - 1; i < j; i++, j--) {
+    unsigned c = loadAddr(str + i);
+    storeAddr(loadAddr(str + j), str + i);
+    storeAddr(c, str + j);
+  }
+}
+
+void upper(unsigned str) {
+  for (unsigned c; (c = loadAddr(str)); str++) {
+    if (c >= 'a' && c <= 'z') {
+      storeAddr(c - 32, str);
+    }
+  }
+}
+
+int main() {
+  unsigned first = loadAddr(BUF) + 'a';
+  for (unsigned i = 0; i < 26; i++) {
+    storeAddr(first + i, BUF + i);
+  }
+  storeAddr(0, BUF + 26);
+  unsigned len = length(BUF);
+  reverse(BUF, len);
+  upper(BUF);
+  printStrAddr(BUF);
+  printChar('\n');
+  return len;
+}
@@ -0,0 +1,174 @@
+; IR of bench/string.c as clang -O1 -fno-discard-value-names -S -emit-llvm gives it,
+; kept here so the cycles of the baseline do not move with the version of clang.
+; Regenerate it whenever bench/string.c changes.
+source_filename = "string.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-pc-linux-gnu"
+
+define i32 @length(i32 %str) local_unnamed_addr {
+entry:
+  br label %cond
+
+cond:                                             ; preds = %cond, %entry
+  %len = phi i32 [ 0, %entry ], [ %len1, %cond ]
+  %a = add i32 %len, %str
+  %c = call i32 @loadAddr(i32 %a)
+  %nz.not = icmp eq i32 %c, 0
+  %len1 = add i32 %len, 1
+  br i1 %nz.not, label %end, label %cond
+
+end:                                              ; preds = %cond
+  ret i32 %len
+}
+
+define void @reverse(i32 %str, i32 %len) local_unnamed_addr {
+entry:
+  %j1 = add i32 %len, -1
+  %lt2.not = icmp eq i32 %j1, 0
+  br i1 %lt2.not, label %end, label %body
+
+body:                                             ; preds = %entry, %body
+  %j4 = phi i32 [ %j, %body ], [ %j1, %entry ]
+  %i3 = phi i32 [ %i1, %body ], [ 0, %entry ]
+  %ai = add i32 %i3, %str
+  %c = call i32 @loadAddr(i32 %ai)
+  %aj = add i32 %j4, %str
+  %cj = call i32 @loadAddr(i32 %aj)
+  call void @storeAddr(i32 %cj, i32 %ai)
+  call void @storeAddr(i32 %c, i32 %aj)
+  %i1 = add nuw i32 %i3, 1
+  %j = add i32 %j4, -1
+  %lt = icmp ult i32 %i1, %j
+  br i1 %lt, label %body, label %end
+
+end:                                              ; preds = %body, %entry
+  ret void
+}
+
+define void @upper(i32 %str0) local_unnamed_addr {
+entry:
+  %c1 = call i32 @loadAddr(i32 %str0)
+  %nz.not2 = icmp eq i32 %c1, 0
+  br i1 %nz.not2, label %end, label %body
+
+body:                                             ; preds = %entry, %inc
+  %c4 = phi i32 [ %c, %inc ], [ %c1, %entry ]
+  %str3 = phi i32 [ %str1, %inc ], [ %str0, %entry ]
+  %0 = add i32 %c4, -97
+  %1 = icmp ult i32 %0, 26
+  br i1 %1, label %then, label %inc
+
+then:                                             ; preds = %body
+  %u = add i32 %c4, -32
+  call void @storeAddr(i32 %u, i32 %str3)
+  br label %inc
+
+inc:                                              ; preds = %then, %body
+  %str1 = add i32 %str3, 1
+  %c = call i32 @loadAddr(i32 %str1)
+  %nz.not = icmp eq i32 %c, 0
+  br i1 %nz.not, label %end, label %body
+
+end:                                              ; preds = %inc, %entry
+  ret void
+}
+
+define i32 @main() local_unnamed_addr {
+entry:
+  %l = call i32 @loadAddr(i32 16640)
+  %first = add i32 %l, 97
+  br label %body
+
+body:                                             ; preds = %entry, %body
+  %i5 = phi i32 [ 0, %entry ], [ %i1, %body ]
+  %v = add i32 %first, %i5
+  %a = add nuw nsw i32 %i5, 16640
+  call void @storeAddr(i32 %v, i32 %a)
+  %i1 = add nuw nsw i32 %i5, 1
+  %exitcond.not = icmp eq i32 %i1, 26
+  br i1 %exitcond.not, label %end, label %body
+
+end:                                              ; preds = %body
+  call void @storeAddr(i32 0, i32 16666)
+  br label %cond.i
+
+cond.i:                                           ; preds = %cond.i, %end
+  %len.i = phi i32 [ 0, %end ], [ %len1.i, %cond.i ]
+  %a.i = add i32 %len.i, 16640
+  %c.i = call i32 @loadAddr(i32 %a.i)
+  %nz.not.i = icmp eq i32 %c.i, 0
+  %len1.i = add i32 %len.i, 1
+  br i1 %nz.not.i, label %length.exit, label %cond.i
+
+length.exit:                                      ; preds = %cond.i
+  %j1.i = add i32 %len.i, -1
+  %lt2.not.i = icmp eq i32 %j1.i, 0
+  br i1 %lt2.not.i, label %reverse.exit, label %body.i
+
+body.i:                                           ; preds = %length.exit, %body.i
+  %j4.i = phi i32 [ %j.i, %body.i ], [ %j1.i, %length.exit ]
+  %i3.i = phi i32 [ %i1.i, %body.i ], [ 0, %length.exit ]
+  %ai.i = add i32 %i3.i, 16640
+  %c.i1 = call i32 @loadAddr(i32 %ai.i)
+  %aj.i = add i32 %j4.i, 16640
+  %cj.i = call i32 @loadAddr(i32 %aj.i)
+  call void @storeAddr(i32 %cj.i, i32 %ai.i)
+  call void @storeAddr(i32 %c.i1, i32 %aj.i)
+  %i1.i = add nuw i32 %i3.i, 1
+  %j.i = add i32 %j4.i, -1
+  %lt.i = icmp ult i32 %i1.i, %j.i
+  br i1 %lt.i, label %body.i, label %reverse.exit
+
+reverse.exit:                                     ; preds = %body.i, %length.exit
+  %c1.i = call i32 @loadAddr(i32 16640)
+  %nz.not2.i = icmp eq i32 %c1.i, 0
+  br i1 %nz.not2.i, label %upper.exit, label %body.i2
+
+body.i2:                                          ; preds = %reverse.exit, %inc.i
+  %c4.i = phi i32 [ %c.i3, %inc.i ], [ %c1.i, %reverse.exit ]
+  %str3.i = phi i32 [ %str1.i, %inc.i ], [ 16640, %reverse.exit ]
+  %0 = add i32 %c4.i, -97
+  %1 = icmp ult i32 %0, 26
+  br i1 %1, label %then.i, label %inc.i
+
+then.i:                                           ; preds = %body.i2
+  %u.i = add i32 %c4.i, -32
+  call void @storeAddr(i32 %u.i, i32 %str3.i)
+  br label %inc.i
+
+inc.i:                                            ; preds = %then.i, %body.i2
+  %str1.i = add i32 %str3.i, 1
+  %c.i3 = call i32 @loadAddr(i32 %str1.i)
+  %nz.not.i4 = icmp eq i32 %c.i3, 0
+  br i1 %nz.not.i4, label %upper.exit, label %body.i2
+
+upper.exit:                                       ; preds = %inc.i, %reverse.exit
+  call void @printStrAddr(i32 16640)
+  call void @printChar(i32 10)
+  ret i32 %len.i
+}
+
+define void @printInt(i32 %x) local_unnamed_addr {
+entry:
+  %big = icmp ugt i32 %x, 10
+  br i1 %big, label %rec, label %out
+
+rec:                                              ; preds = %entry
+  %q = udiv i32 %x, 10
+  call void @printInt(i32 %q)
+  br label %out
+
+out:                                              ; preds = %rec, %entry
+  %r = urem i32 %x, 10
+  %c = or disjoint i32 %r, 48
+  call void @printChar(i32 %c)
+  ret void
+}
+
+declare void @printStrAddr(i32) local_unnamed_addr
+
+declare void @printChar(i32) local_unnamed_addr
+
+declare i32 @loadAddr(i32) local_unnamed_addr
+
+declare void @storeAddr(i32, i32) local_unnamed_addr
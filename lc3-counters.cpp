@@ -0,0 +1,176 @@
+// Reads back the block counters a program built with -lc3-instrument prints,
+// from the output of any simulator it ran in, and reports the hottest blocks
+// and functions.
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> CountersFileName(cl::Positional,
+                                             cl::desc("<.counters file>"),
+                                             cl::Required);
+
+static cl::opt<std::string> OutputFileName(cl::Positional,
+                                           cl::desc("<program output>"),
+                                           cl::init("-"));
+
+static cl::opt<std::string> CountsFileName(
+    "counts",
+    cl::desc("Write the executions of each basic block to this file, for "
+             "-lc3-profile"),
+    cl::value_desc("filename"), cl::init(""));
+
+// A counter, with the function, the label and the name of its block.
+struct LC3Counter {
+  std::string Func;
+  std::string Label;
+  std::string Block;
+  uint64_t Count = 0;
+};
+
+// Reads the counters the pass listed, in the order the program prints them.
+static bool readCounters(StringRef FileName,
+                         std::vector<LC3Counter> &Counters) {
+  auto Buffer = MemoryBuffer::getFile(FileName);
+  if (!Buffer) {
+    errs() << "Error: " << FileName << ": " << Buffer.getError().message()
+           << "\n";
+    return false;
+  }
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    SmallVector<StringRef, 3> Fields;
+    Line.rtrim().split(Fields, '\t');
+    if (Fields.size() != 3) {
+      errs() << "Error: " << FileName << ": not a counters file\n";
+      return false;
+    }
+    Counters.push_back({Fields[0].str(), Fields[1].str(), Fields[2].str()});
+  }
+  return true;
+}
+
+// Reads the counts of the last dump in the output of the program. Dumps
+// start with a "LC3 COUNTERS" line and end with a "LC3 COUNTERS END" one,
+// with a count in hexadecimal on each line between them.
+static bool readCounts(StringRef FileName, std::vector<LC3Counter> &Counters) {
+  auto Buffer = MemoryBuffer::getFileOrSTDIN(FileName);
+  if (!Buffer) {
+    errs() << "Error: " << FileName << ": " << Buffer.getError().message()
+           << "\n";
+    return false;
+  }
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n');
+  size_t Begin = Lines.size();
+  for (size_t Index = 0; Index < Lines.size(); Index++) {
+    if (Lines[Index].trim() == "LC3 COUNTERS") {
+      Begin = Index + 1;
+    }
+  }
+  if (Begin == Lines.size()) {
+    errs() << "Error: " << FileName << ": no counters printed\n";
+    return false;
+  }
+  size_t Index = Begin;
+  for (auto &Counter : Counters) {
+    unsigned Count;
+    if (Index == Lines.size() ||
+        Lines[Index].trim().getAsInteger(16, Count)) {
+      errs() << "Error: " << FileName << ": " << Index + 1
+             << ": count expected\n";
+      return false;
+    }
+    Counter.Count = Count;
+    Index++;
+  }
+  if (Index == Lines.size() || Lines[Index].trim() != "LC3 COUNTERS END") {
+    errs() << "Error: " << FileName << ": " << Counters.size()
+           << " counts expected, the counters file does not match the "
+              "program\n";
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv,
+                              "LC-3 block counters reader\n"
+                              "Reports the block counts a program built with "
+                              "-lc3-instrument printed\n");
+
+  std::vector<LC3Counter> Counters;
+  if (!readCounters(CountersFileName, Counters) ||
+      !readCounts(OutputFileName, Counters)) {
+    return 1;
+  }
+
+  // A function is called as many times as its first block, its entry, runs.
+  uint64_t Total = 0;
+  StringMap<std::pair<uint64_t, uint64_t>> Funcs;
+  std::vector<std::string> FuncOrder;
+  for (auto &Counter : Counters) {
+    Total += Counter.Count;
+    auto [It, Inserted] = Funcs.try_emplace(Counter.Func, Counter.Count, 0);
+    if (Inserted) {
+      FuncOrder.push_back(Counter.Func);
+    }
+    It->second.second += Counter.Count;
+  }
+  auto Percent = [&](uint64_t Count) {
+    return Total ? 100.0 * Count / Total : 0.0;
+  };
+
+  std::vector<const LC3Counter *> Blocks;
+  for (auto &Counter : Counters) {
+    Blocks.push_back(&Counter);
+  }
+  llvm::stable_sort(Blocks, [](const LC3Counter *A, const LC3Counter *B) {
+    return A->Count > B->Count;
+  });
+  outs() << "Blocks by executions, " << Total << " in total\n"
+         << "  executions       %  block  function\n";
+  for (const LC3Counter *Block : Blocks) {
+    outs() << format("%12llu %6.2f%%  ", (unsigned long long)Block->Count,
+                     Percent(Block->Count))
+           << Block->Label << "  " << Block->Func << "\n";
+  }
+
+  llvm::stable_sort(FuncOrder, [&](const std::string &A, const std::string &B) {
+    return Funcs[A].second > Funcs[B].second;
+  });
+  outs() << "\nFunctions by block executions\n"
+         << "       calls   executions       %  function\n";
+  for (auto &Func : FuncOrder) {
+    auto [Calls, Count] = Funcs[Func];
+    outs() << format("%12llu %12llu %6.2f%%  ", (unsigned long long)Calls,
+                     (unsigned long long)Count, Percent(Count))
+           << Func << "\n";
+  }
+
+  if (!CountsFileName.empty()) {
+    std::error_code EC;
+    ToolOutputFile Counts(CountsFileName, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return 1;
+    }
+    for (auto &Counter : Counters) {
+      Counts.os() << Counter.Func << "\t" << Counter.Block << "\t"
+                  << Counter.Count << "\n";
+    }
+    Counts.keep();
+  }
+  return 0;
+}
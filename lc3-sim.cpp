@@ -0,0 +1,350 @@
+// Runs an LC-3 program, given as the .asm file the pass generates or as an
+// object file, and reports what it cost. It can also profile the program,
+// down to the IR instructions with the .map file of the pass.
+
+#include "LC3Assembler.h"
+#include "LC3MachineInst.h"
+#include "LC3Simulator.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <map>
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFileName(cl::Positional,
+                                          cl::desc("<.asm or .obj file>"),
+                                          cl::Required);
+
+static cl::opt<unsigned>
+    MemCycles("mem-cycles",
+              cl::desc("Specify the cycles a memory access takes, default 5"),
+              cl::value_desc("mem-cycles"), cl::init(5));
+
+static cl::opt<uint64_t> MaxInsts(
+    "max-insts",
+    cl::desc("Stop after this many instructions, default 100000000"),
+    cl::value_desc("max-insts"), cl::init(100000000));
+
+static cl::opt<std::string> ProfileFileName(
+    "profile",
+    cl::desc("Write the cycles spent in each block and, with a map, in each IR "
+             "instruction to this file"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> FoldedFileName(
+    "folded",
+    cl::desc("Write the cycles spent in each call stack to this file, one "
+             "folded stack per line as flame graph tools read them"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> CountsFileName(
+    "counts",
+    cl::desc("Write the executions of each basic block to this file, for "
+             "-lc3-profile, which needs the map"),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<std::string> MapFileName(
+    "map",
+    cl::desc("Read the .map file written by the pass with -lc3-map from this "
+             "file, default the one next to the input file if any"),
+    cl::value_desc("filename"), cl::init(""));
+
+// What the .map file says about a word: its function, basic block, source
+// line and IR instruction, "-" when not known.
+struct LC3MapEntry {
+  std::string Func = "-";
+  std::string Block = "-";
+  std::string Line = "-";
+  std::string Text = "-";
+};
+
+// Labels of the program by address, in the order they are defined.
+static std::map<uint16_t, std::vector<std::string>> Labels;
+// Entries of the .map file by address.
+static std::vector<LC3MapEntry> Map;
+
+// Reads the labels of a .sym file, as lc3as writes them.
+static void readSymbols(StringRef FileName) {
+  auto Buffer = MemoryBuffer::getFile(FileName);
+  if (!Buffer) {
+    return;
+  }
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n');
+  for (StringRef Line : Lines) {
+    SmallVector<StringRef, 4> Fields;
+    Line.consume_front("//");
+    Line.split(Fields, ' ', -1, false);
+    unsigned Addr;
+    if (Fields.size() == 2 && Fields[1].size() == 4 &&
+        !Fields[1].getAsInteger(16, Addr)) {
+      Labels[Addr].push_back(Fields[0].trim().str());
+    }
+  }
+}
+
+// Reads the .map file written by the pass.
+static bool readMap(StringRef FileName) {
+  auto Buffer = MemoryBuffer::getFile(FileName);
+  if (!Buffer) {
+    errs() << "Error: " << FileName << ": " << Buffer.getError().message()
+           << "\n";
+    return false;
+  }
+  Map.resize(0x10000);
+  SmallVector<StringRef, 64> Lines;
+  (*Buffer)->getBuffer().split(Lines, '\n', -1, false);
+  for (StringRef Line : Lines) {
+    SmallVector<StringRef, 5> Fields;
+    Line.split(Fields, '\t');
+    unsigned Addr;
+    if (Fields.size() != 5 || !Fields[0].consume_front("x") ||
+        Fields[0].getAsInteger(16, Addr) || Addr > 0xFFFF) {
+      errs() << "Error: " << FileName << ": not a map file\n";
+      return false;
+    }
+    Map[Addr] = {Fields[1].str(), Fields[2].str(), Fields[3].str(),
+                 Fields[4].str()};
+  }
+  return true;
+}
+
+// Returns the label of the block Addr is in, the last one defined at or
+// before it.
+static StringRef getBlock(uint16_t Addr) {
+  auto It = Labels.upper_bound(Addr);
+  if (It == Labels.begin()) {
+    return "-";
+  }
+  return std::prev(It)->second.back();
+}
+
+// Returns the name of the function starting at Addr.
+static std::string getFuncName(uint16_t Addr) {
+  if (!Map.empty() && Map[Addr].Func != "-") {
+    return Map[Addr].Func;
+  }
+  auto It = Labels.find(Addr);
+  if (It != Labels.end()) {
+    return It->second.front();
+  }
+  std::string Name;
+  raw_string_ostream(Name) << format("x%04X", Addr);
+  return Name;
+}
+
+// Writes the cycles of the blocks, then the ones of the IR instructions if
+// the map is known, the most expensive first.
+static void writeProfile(const LC3Simulator &Simulator, raw_ostream &OS) {
+  uint64_t Total = Simulator.getNumCycles();
+  auto Percent = [&](uint64_t Cycles) {
+    return Total ? 100.0 * Cycles / Total : 0.0;
+  };
+
+  // The executions of a block are the ones of its most executed word.
+  StringMap<std::pair<uint64_t, uint64_t>> Blocks;
+  StringMap<uint16_t> BlockAddrs;
+  StringMap<uint64_t> Insts;
+  for (unsigned Addr = 0; Addr < 0x10000; Addr++) {
+    uint64_t Cycles = Simulator.getCycles(Addr);
+    if (!Cycles) {
+      continue;
+    }
+    StringRef Block = getBlock(Addr);
+    auto &[BlockCycles, Executions] = Blocks[Block];
+    BlockCycles += Cycles;
+    Executions = std::max(Executions, Simulator.getExecutions(Addr));
+    BlockAddrs.try_emplace(Block, Addr);
+    if (!Map.empty()) {
+      auto &Entry = Map[Addr];
+      Insts[Entry.Func + "\t" + Entry.Line + "\t" + Entry.Text] += Cycles;
+    }
+  }
+
+  std::vector<std::pair<uint64_t, StringRef>> Lines;
+  for (auto &Block : Blocks) {
+    Lines.push_back({Block.second.first, Block.first()});
+  }
+  llvm::sort(Lines, [](auto &A, auto &B) { return A.first > B.first; });
+  OS << "Cycles by block, " << Total << " in total\n"
+     << "      cycles       %   executions  block  function\n";
+  for (auto &[Cycles, Block] : Lines) {
+    StringRef Func = Map.empty() ? "-" : Map[BlockAddrs[Block]].Func;
+    OS << format("%12llu %6.2f%% %12llu  ", (unsigned long long)Cycles,
+                 Percent(Cycles), (unsigned long long)Blocks[Block].second)
+       << Block << "  " << Func << "\n";
+  }
+  if (Map.empty()) {
+    return;
+  }
+
+  Lines.clear();
+  for (auto &Inst : Insts) {
+    Lines.push_back({Inst.second, Inst.first()});
+  }
+  llvm::sort(Lines, [](auto &A, auto &B) { return A.first > B.first; });
+  OS << "\nCycles by IR instruction\n"
+     << "      cycles       %  function  line  instruction\n";
+  for (auto &[Cycles, Inst] : Lines) {
+    SmallVector<StringRef, 3> Fields;
+    Inst.split(Fields, '\t');
+    OS << format("%12llu %6.2f%%  ", (unsigned long long)Cycles,
+                 Percent(Cycles))
+       << Fields[0] << "  " << Fields[1] << "  " << Fields[2] << "\n";
+  }
+}
+
+// Writes the executions of each basic block, one "function<tab>block<tab>
+// count" line per block, as -lc3-profile reads them. A block runs as often
+// as its first word.
+static void writeCounts(const LC3Simulator &Simulator, raw_ostream &OS) {
+  for (unsigned Addr = 0; Addr < Map.size(); Addr++) {
+    auto &Entry = Map[Addr];
+    if (Entry.Block != "-" &&
+        (!Addr || Entry.Func != Map[Addr - 1].Func ||
+         Entry.Block != Map[Addr - 1].Block)) {
+      OS << Entry.Func << "\t" << Entry.Block << "\t"
+         << Simulator.getExecutions(Addr) << "\n";
+    }
+  }
+}
+
+// Writes one line per call stack, its functions, block and IR instruction
+// separated by ';', then the cycles spent there.
+static void writeFolded(const LC3Simulator &Simulator, raw_ostream &OS) {
+  StringMap<uint64_t> Stacks;
+  Simulator.forEachStack(
+      [&](ArrayRef<uint16_t> Funcs, uint16_t Addr, uint64_t Cycles) {
+        std::string Stack;
+        for (uint16_t Func : Funcs) {
+          Stack += getFuncName(Func) + ";";
+        }
+        Stack += getBlock(Addr);
+        if (!Map.empty() && Map[Addr].Text != "-") {
+          std::string Text = Map[Addr].Text;
+          std::replace(Text.begin(), Text.end(), ';', ',');
+          Stack += ";" + Text;
+        }
+        Stacks[Stack] += Cycles;
+      });
+  std::vector<std::pair<StringRef, uint64_t>> Lines;
+  for (auto &Stack : Stacks) {
+    Lines.push_back({Stack.first(), Stack.second});
+  }
+  llvm::sort(Lines);
+  for (auto &[Stack, Cycles] : Lines) {
+    OS << Stack << " " << Cycles << "\n";
+  }
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "LC-3 simulator\n");
+
+  auto Buffer = MemoryBuffer::getFile(InputFileName);
+  if (!Buffer) {
+    errs() << "Error: " << InputFileName << ": "
+           << Buffer.getError().message() << "\n";
+    return 1;
+  }
+  StringRef Content = (*Buffer)->getBuffer();
+
+  uint16_t Origin;
+  std::vector<uint16_t> Words;
+  if (StringRef(InputFileName).endswith(".obj")) {
+    if (Content.size() < 2 || Content.size() % 2) {
+      errs() << "Error: " << InputFileName << ": not an object file\n";
+      return 1;
+    }
+    for (size_t Pos = 0; Pos < Content.size(); Pos += 2) {
+      Words.push_back((uint8_t)Content[Pos] << 8 | (uint8_t)Content[Pos + 1]);
+    }
+    Origin = Words.front();
+    Words.erase(Words.begin());
+    SmallString<128> SymFileName(InputFileName);
+    sys::path::replace_extension(SymFileName, "sym");
+    readSymbols(SymFileName);
+  } else {
+    LC3Assembler Assembler;
+    if (!Assembler.assemble(parseLC3(Content), InputFileName)) {
+      return 1;
+    }
+    Origin = Assembler.getOrigin();
+    Words = Assembler.getWords().vec();
+    for (auto &[Label, Addr] : Assembler.getSymbols()) {
+      Labels[Addr].push_back(Label);
+    }
+  }
+
+  LC3Simulator Simulator(MemCycles);
+  Simulator.load(Origin, Words);
+  bool Profiling = !ProfileFileName.empty() || !FoldedFileName.empty() ||
+                   !CountsFileName.empty();
+  if (Profiling) {
+    SmallString<128> DefaultMap(InputFileName);
+    sys::path::replace_extension(DefaultMap, "map");
+    if (MapFileName.empty() && sys::fs::exists(DefaultMap)) {
+      MapFileName = DefaultMap.str().str();
+    }
+    if (!MapFileName.empty() && !readMap(MapFileName)) {
+      return 1;
+    }
+    if (!CountsFileName.empty() && Map.empty()) {
+      errs() << "Error: -counts needs the map of the program\n";
+      return 1;
+    }
+    // A function starts where the map goes from one to another.
+    std::vector<uint16_t> Entries;
+    for (unsigned Addr = 0; Addr < Map.size(); Addr++) {
+      if (Map[Addr].Func != "-" &&
+          (!Addr || Map[Addr].Func != Map[Addr - 1].Func)) {
+        Entries.push_back(Addr);
+      }
+    }
+    Simulator.enableProfile(Entries);
+  }
+  bool Halted = Simulator.run(Origin, MaxInsts, outs());
+  outs().flush();
+
+  errs() << "Instructions: " << Simulator.getNumInsts() << "\n"
+         << "Memory reads: " << Simulator.getNumReads() << "\n"
+         << "Memory writes: " << Simulator.getNumWrites() << "\n"
+         << "Cycles: " << Simulator.getNumCycles() << "\n"
+         << "R0: " << (int16_t)Simulator.getReg(0) << "\n";
+
+  std::error_code EC;
+  if (!ProfileFileName.empty()) {
+    ToolOutputFile Profile(ProfileFileName, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return 1;
+    }
+    writeProfile(Simulator, Profile.os());
+    Profile.keep();
+  }
+  if (!FoldedFileName.empty()) {
+    ToolOutputFile Folded(FoldedFileName, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return 1;
+    }
+    writeFolded(Simulator, Folded.os());
+    Folded.keep();
+  }
+  if (!CountsFileName.empty()) {
+    ToolOutputFile Counts(CountsFileName, EC, sys::fs::OF_Text);
+    if (EC) {
+      errs() << "Error: " << EC.message() << "\n";
+      return 1;
+    }
+    writeCounts(Simulator, Counts.os());
+    Counts.keep();
+  }
+  return Halted ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+# Translates the IR program TEST with the pass, runs it in lc3-sim and checks
+# the value main returns in R0 against its "; RESULT: <value>" line. Options
+# for the pass are taken from its "; OPTIONS: <options>" line. Each
+# "; BOUNDS: <frame> <stack> <cycles> <function>" line must be one of the
+# .bounds file written with -lc3-bounds.
+#
+# Run through ctest, which sets OPT, PASS, SIM, TEST and WORK_DIR.
+
+file(STRINGS ${TEST} Result REGEX "^; RESULT: ")
+file(STRINGS ${TEST} Options REGEX "^; OPTIONS: ")
+string(REGEX REPLACE ".*RESULT: *" "" Result "${Result}")
+string(REGEX REPLACE ".*OPTIONS: *" "" Options "${Options}")
+separate_arguments(Options)
+get_filename_component(Name ${TEST} NAME_WE)
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(REMOVE ${WORK_DIR}/${Name}.obj)
+
+execute_process(
+  COMMAND ${OPT} -load-pass-plugin=${PASS} -passes=llvm-ir-to-lc3-pass
+          -lc3-obj ${Options} -disable-output ${TEST}
+  WORKING_DIRECTORY ${WORK_DIR}
+  RESULT_VARIABLE Failed
+  ERROR_VARIABLE Error)
+if(Failed OR NOT EXISTS ${WORK_DIR}/${Name}.obj)
+  message(FATAL_ERROR "${Name}: translation failed\n${Error}")
+endif()
+execute_process(
+  COMMAND ${SIM} ${Name}.obj
+  WORKING_DIRECTORY ${WORK_DIR}
+  RESULT_VARIABLE Failed
+  OUTPUT_VARIABLE Output
+  ERROR_VARIABLE Stats)
+if(Failed)
+  message(FATAL_ERROR "${Name}: simulation failed\n${Output}${Stats}")
+endif()
+string(REGEX MATCH "R0: (-?[0-9]+)" _ "${Stats}")
+if(NOT CMAKE_MATCH_1 STREQUAL Result)
+  message(FATAL_ERROR "${Name}: R0 is ${CMAKE_MATCH_1}, ${Result} expected")
+endif()
+
+file(STRINGS ${TEST} Bounds REGEX "^; BOUNDS: ")
+if(Bounds)
+  file(STRINGS ${WORK_DIR}/${Name}.bounds Written)
+  string(REGEX REPLACE " +" " " Written "${Written}")
+  string(REGEX REPLACE "(^|;) " "\\1" Written "${Written}")
+  foreach(Bound ${Bounds})
+    string(REGEX REPLACE ".*BOUNDS: *" "" Bound "${Bound}")
+    list(FIND Written "${Bound}" Found)
+    if(Found LESS 0)
+      list(JOIN Written "\n" Written)
+      message(FATAL_ERROR "${Name}: no bound \"${Bound}\" in\n${Written}")
+    endif()
+  endforeach()
+endif()
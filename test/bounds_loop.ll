@@ -0,0 +1,27 @@
+; The loop of @count runs 10 times at most, ScalarEvolution tells. With 5
+; cycles a memory access, ADD and AND take 9 cycles, BR and JSR 10, LDR and
+; STR 15. @count takes 48 for its entry, 10 times 28 for %loop and 19 for
+; the copy of the PHI on its back edge, 9 for %done and 48 for its
+; epilogue: 575. @main adds 52 and 33 for its own blocks.
+; RESULT: 10
+; OPTIONS: -lc3-bounds -lc3-inline-budget=0
+; BOUNDS: 2 2 575 count
+; BOUNDS: 1 3 660 main
+
+define i32 @count(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i1, %loop ]
+  %i1 = add i32 %i, 1
+  %c = icmp ult i32 %i1, 10
+  br i1 %c, label %loop, label %done
+done:
+  ret i32 %i1
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @count(i32 3)
+  ret i32 %r
+}
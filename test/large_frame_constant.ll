@@ -0,0 +1,166 @@
+; @f has more objects than LDR and STR reach from R5, its frame is laid out
+; before the lowering. The null pointer coming into the PHI is a constant to
+; load, not a value with a slot of its own: a slot added then is never
+; written, and leaves R6 off by one word.
+; RESULT: 11441
+; OPTIONS: -lc3-inline-budget=0
+
+define i32 @h(i32 %x) {
+entry:
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+define i32 @g(i32 %x) {
+entry:
+  %y = call i32 @h(i32 %x)
+  ret i32 %y
+}
+
+define i32 @f(i32 %c, ptr %q) {
+entry:
+  %a0 = alloca i32
+  %a1 = alloca i32
+  %a2 = alloca i32
+  %a3 = alloca i32
+  %a4 = alloca i32
+  %a5 = alloca i32
+  %a6 = alloca i32
+  %a7 = alloca i32
+  %a8 = alloca i32
+  %a9 = alloca i32
+  %a10 = alloca i32
+  %a11 = alloca i32
+  %a12 = alloca i32
+  %a13 = alloca i32
+  %a14 = alloca i32
+  %a15 = alloca i32
+  %a16 = alloca i32
+  %a17 = alloca i32
+  %a18 = alloca i32
+  %a19 = alloca i32
+  %a20 = alloca i32
+  %a21 = alloca i32
+  %a22 = alloca i32
+  %a23 = alloca i32
+  %a24 = alloca i32
+  %a25 = alloca i32
+  %a26 = alloca i32
+  %a27 = alloca i32
+  %a28 = alloca i32
+  %a29 = alloca i32
+  %a30 = alloca i32
+  %a31 = alloca i32
+  store i32 1, ptr %a0
+  store i32 4, ptr %a1
+  store i32 9, ptr %a2
+  store i32 16, ptr %a3
+  store i32 25, ptr %a4
+  store i32 36, ptr %a5
+  store i32 49, ptr %a6
+  store i32 64, ptr %a7
+  store i32 81, ptr %a8
+  store i32 100, ptr %a9
+  store i32 121, ptr %a10
+  store i32 144, ptr %a11
+  store i32 169, ptr %a12
+  store i32 196, ptr %a13
+  store i32 225, ptr %a14
+  store i32 256, ptr %a15
+  store i32 289, ptr %a16
+  store i32 324, ptr %a17
+  store i32 361, ptr %a18
+  store i32 400, ptr %a19
+  store i32 441, ptr %a20
+  store i32 484, ptr %a21
+  store i32 529, ptr %a22
+  store i32 576, ptr %a23
+  store i32 625, ptr %a24
+  store i32 676, ptr %a25
+  store i32 729, ptr %a26
+  store i32 784, ptr %a27
+  store i32 841, ptr %a28
+  store i32 900, ptr %a29
+  store i32 961, ptr %a30
+  store i32 1024, ptr %a31
+  %k = call i32 @g(i32 %c)
+  %t = icmp eq i32 %k, 0
+  br i1 %t, label %then, label %join
+then:
+  br label %join
+join:
+  %p = phi ptr [ null, %entry ], [ %q, %then ]
+  %pi = ptrtoint ptr %p to i32
+  %zi = add i32 %pi, 1
+  %v0 = load i32, ptr %a0
+  %s0 = add i32 %zi, %v0
+  %v1 = load i32, ptr %a1
+  %s1 = add i32 %s0, %v1
+  %v2 = load i32, ptr %a2
+  %s2 = add i32 %s1, %v2
+  %v3 = load i32, ptr %a3
+  %s3 = add i32 %s2, %v3
+  %v4 = load i32, ptr %a4
+  %s4 = add i32 %s3, %v4
+  %v5 = load i32, ptr %a5
+  %s5 = add i32 %s4, %v5
+  %v6 = load i32, ptr %a6
+  %s6 = add i32 %s5, %v6
+  %v7 = load i32, ptr %a7
+  %s7 = add i32 %s6, %v7
+  %v8 = load i32, ptr %a8
+  %s8 = add i32 %s7, %v8
+  %v9 = load i32, ptr %a9
+  %s9 = add i32 %s8, %v9
+  %v10 = load i32, ptr %a10
+  %s10 = add i32 %s9, %v10
+  %v11 = load i32, ptr %a11
+  %s11 = add i32 %s10, %v11
+  %v12 = load i32, ptr %a12
+  %s12 = add i32 %s11, %v12
+  %v13 = load i32, ptr %a13
+  %s13 = add i32 %s12, %v13
+  %v14 = load i32, ptr %a14
+  %s14 = add i32 %s13, %v14
+  %v15 = load i32, ptr %a15
+  %s15 = add i32 %s14, %v15
+  %v16 = load i32, ptr %a16
+  %s16 = add i32 %s15, %v16
+  %v17 = load i32, ptr %a17
+  %s17 = add i32 %s16, %v17
+  %v18 = load i32, ptr %a18
+  %s18 = add i32 %s17, %v18
+  %v19 = load i32, ptr %a19
+  %s19 = add i32 %s18, %v19
+  %v20 = load i32, ptr %a20
+  %s20 = add i32 %s19, %v20
+  %v21 = load i32, ptr %a21
+  %s21 = add i32 %s20, %v21
+  %v22 = load i32, ptr %a22
+  %s22 = add i32 %s21, %v22
+  %v23 = load i32, ptr %a23
+  %s23 = add i32 %s22, %v23
+  %v24 = load i32, ptr %a24
+  %s24 = add i32 %s23, %v24
+  %v25 = load i32, ptr %a25
+  %s25 = add i32 %s24, %v25
+  %v26 = load i32, ptr %a26
+  %s26 = add i32 %s25, %v26
+  %v27 = load i32, ptr %a27
+  %s27 = add i32 %s26, %v27
+  %v28 = load i32, ptr %a28
+  %s28 = add i32 %s27, %v28
+  %v29 = load i32, ptr %a29
+  %s29 = add i32 %s28, %v29
+  %v30 = load i32, ptr %a30
+  %s30 = add i32 %s29, %v30
+  %v31 = load i32, ptr %a31
+  %s31 = add i32 %s30, %v31
+  ret i32 %s31
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @f(i32 5, ptr null)
+  ret i32 %r
+}
@@ -0,0 +1,42 @@
+; A value live into a block laid out before its definition must not be kept
+; in a register the first instruction of that block clobbers: %v to %y are
+; live across the call of @g, which clobbers R0 and R7.
+; RESULT: 78
+; OPTIONS: -lc3-inline-budget=0
+
+define i32 @g(i32 %x) {
+entry:
+  %c = icmp sgt i32 %x, 0
+  br i1 %c, label %rec, label %done
+rec:
+  %y = add i32 %x, -1
+  %r = call i32 @g(i32 %y)
+  %s = add i32 %r, 1
+  ret i32 %s
+done:
+  ret i32 0
+}
+
+define i32 @h(i32 %a) {
+entry:
+  br label %def
+use:
+  %c = call i32 @g(i32 3)
+  %s1 = add i32 %v, %c
+  %s2 = add i32 %s1, %w
+  %s3 = add i32 %s2, %x
+  %s4 = add i32 %s3, %y
+  ret i32 %s4
+def:
+  %v = add i32 %a, 40
+  %w = add i32 %a, 7
+  %x = add i32 %a, 9
+  %y = add i32 %a, 11
+  br label %use
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @h(i32 2)
+  ret i32 %r
+}
@@ -0,0 +1,27 @@
+; The arguments of @f are moved to their registers at once. When two of them
+; swap registers, the temporary breaking the cycle must not be the register
+; of an argument that stays where it is: %a is kept in R0 here.
+; RESULT: 221
+; OPTIONS: -lc3-inline-budget=0
+
+define i32 @h(i32 %x, i32 %y) {
+entry:
+  %s = add i32 %x, %y
+  ret i32 %s
+}
+
+define i32 @f(i32 %a, i32 %b, i32 %c) {
+entry:
+  %s = add i32 %a, %c
+  %r = call i32 @h(i32 %s, i32 %s)
+  %t = add i32 %r, %b
+  %z = sub i32 %r, %r
+  %u = add i32 %t, %z
+  ret i32 %u
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @f(i32 100, i32 1, i32 10)
+  ret i32 %r
+}
@@ -0,0 +1,66 @@
+; With static frames, the functions that are never active twice at once
+; keep their frames at fixed addresses, the ones of @a and @d overlapping.
+; The values live across the calls of the chain @a, @b, @c stay in the
+; frames, and each caller points R5 back at its own frame after a call.
+; RESULT: 148
+; OPTIONS: -lc3-static-frames -lc3-inline-budget=0
+
+define i32 @c(i32 %x, i32 %y) {
+entry:
+  %s = mul i32 %x, %y
+  %t = sub i32 %s, %x
+  ret i32 %t
+}
+
+define i32 @b(i32 %x, i32 %y, i32 %z) {
+entry:
+  %p = add i32 %x, %y
+  %q = sub i32 %y, %z
+  %r = add i32 %z, 3
+  %w = add i32 %x, 5
+  %u = call i32 @c(i32 %p, i32 %q)
+  %v = call i32 @c(i32 %q, i32 %r)
+  %s1 = add i32 %u, %v
+  %s2 = add i32 %s1, %p
+  %s3 = sub i32 %s2, %q
+  %s4 = add i32 %s3, %r
+  %s5 = add i32 %s4, %w
+  %s6 = sub i32 %s5, %z
+  ret i32 %s6
+}
+
+define i32 @a(i32 %n) {
+entry:
+  %m = add i32 %n, 1
+  %k = add i32 %n, 2
+  %j = add i32 %n, 7
+  %x = call i32 @b(i32 %n, i32 %m, i32 %k)
+  %y = call i32 @b(i32 %k, i32 %j, i32 %n)
+  %d = sub i32 %x, %y
+  %e = add i32 %d, %m
+  %f = add i32 %e, %j
+  %g = sub i32 %f, %k
+  ret i32 %g
+}
+
+define i32 @d(i32 %n) {
+entry:
+  %m = add i32 %n, 3
+  %k = add i32 %n, 6
+  %x = call i32 @c(i32 %m, i32 %k)
+  %y = call i32 @c(i32 %k, i32 %n)
+  %s = sub i32 %x, %y
+  %t = add i32 %s, %m
+  %u = sub i32 %t, %k
+  ret i32 %u
+}
+
+define i32 @main() {
+entry:
+  %r1 = call i32 @a(i32 4)
+  %r2 = call i32 @d(i32 5)
+  %r3 = call i32 @a(i32 9)
+  %s = sub i32 %r1, %r3
+  %r = add i32 %s, %r2
+  ret i32 %r
+}
@@ -0,0 +1,47 @@
+; A dense switch from 0 jumps through a table after comparing its hot case,
+; 3 here, first. The table must test the sign of the condition, not the one
+; of the compare with the hot case: @f(1) has to take case 1.
+; RESULT: 2431
+; OPTIONS: -lc3-inline-budget=0
+
+define i32 @f(i32 %x) !prof !0 {
+entry:
+  switch i32 %x, label %def [
+    i32 0, label %a
+    i32 1, label %b
+    i32 2, label %c
+    i32 3, label %d
+    i32 4, label %e
+  ], !prof !1
+a:
+  ret i32 1
+b:
+  ret i32 2
+c:
+  ret i32 3
+d:
+  ret i32 4
+e:
+  ret i32 5
+def:
+  ret i32 0
+}
+
+define i32 @main() {
+entry:
+  %b = call i32 @f(i32 1)
+  %d = call i32 @f(i32 3)
+  %def = call i32 @f(i32 7)
+  %c = call i32 @f(i32 2)
+  %b10 = mul i32 %b, 1000
+  %d100 = mul i32 %d, 100
+  %c10 = mul i32 %c, 10
+  %s1 = add i32 %b10, %d100
+  %s2 = add i32 %s1, %c10
+  %s3 = add i32 %s2, %def
+  %s4 = add i32 %s3, 1
+  ret i32 %s4
+}
+
+!0 = !{!"function_entry_count", i64 100}
+!1 = !{!"branch_weights", i32 1, i32 5, i32 5, i32 5, i32 80, i32 5}
@@ -0,0 +1,79 @@
+; Tail calls jump to their callee once the arguments are in place: @gcd and
+; @rot call themselves with their arguments permuted, @sib calls @diff with
+; fewer arguments, also out of order. @pick returns from two blocks through
+; the epilogue they share.
+; RESULT: 1923
+; OPTIONS: -lc3-inline-budget=0
+
+define i32 @gcd(i32 %a, i32 %b) {
+entry:
+  %z = icmp eq i32 %b, 0
+  br i1 %z, label %done, label %rec
+rec:
+  %r = urem i32 %a, %b
+  %g = call i32 @gcd(i32 %b, i32 %r)
+  ret i32 %g
+done:
+  ret i32 %a
+}
+
+define i32 @rot(i32 %a, i32 %b, i32 %c, i32 %n) {
+entry:
+  %z = icmp eq i32 %n, 0
+  br i1 %z, label %done, label %rec
+rec:
+  %m = add i32 %n, -1
+  %r = call i32 @rot(i32 %c, i32 %a, i32 %b, i32 %m)
+  ret i32 %r
+done:
+  %a100 = mul i32 %a, 100
+  %b10 = mul i32 %b, 10
+  %s = add i32 %a100, %b10
+  %t = add i32 %s, %c
+  ret i32 %t
+}
+
+define i32 @diff(i32 %x, i32 %y) {
+entry:
+  %d = sub i32 %x, %y
+  ret i32 %d
+}
+
+define i32 @sib(i32 %a, i32 %b, i32 %c) {
+entry:
+  %x = add i32 %c, %b
+  %r = call i32 @diff(i32 %x, i32 %a)
+  ret i32 %r
+}
+
+define i32 @pick(i32 %x, i32 %y) {
+entry:
+  %c = icmp slt i32 %x, %y
+  br i1 %c, label %lt, label %ge
+lt:
+  %a = call i32 @gcd(i32 %y, i32 %x)
+  %s = add i32 %a, %x
+  ret i32 %s
+ge:
+  %b = call i32 @diff(i32 %x, i32 %y)
+  %t = add i32 %b, %y
+  ret i32 %t
+}
+
+define i32 @main() {
+entry:
+  %g = call i32 @gcd(i32 1071, i32 462)
+  %r = call i32 @rot(i32 1, i32 2, i32 3, i32 4)
+  %s = call i32 @sib(i32 5, i32 100, i32 7)
+  %p = call i32 @pick(i32 12, i32 30)
+  %q = call i32 @pick(i32 30, i32 12)
+  %r3 = mul i32 %r, 3
+  %s5 = mul i32 %s, 5
+  %p7 = mul i32 %p, 7
+  %q11 = mul i32 %q, 11
+  %t1 = add i32 %g, %r3
+  %t2 = add i32 %t1, %s5
+  %t3 = add i32 %t2, %p7
+  %t4 = add i32 %t3, %q11
+  ret i32 %t4
+}
@@ -0,0 +1,40 @@
+; Divisors with their top bit set take the short path of the long division:
+; the quotient is 0 or 1 and the remainder the dividend, less the divisor
+; when the quotient is 1.
+; RESULT: 13778
+; OPTIONS: -lc3-inline-budget=0
+
+define i32 @quo(i32 %a, i32 %b) {
+entry:
+  %q = udiv i32 %a, %b
+  ret i32 %q
+}
+
+define i32 @rem(i32 %a, i32 %b) {
+entry:
+  %r = urem i32 %a, %b
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  %q1 = call i32 @quo(i32 50000, i32 40000)
+  %r1 = call i32 @rem(i32 50000, i32 40000)
+  %q2 = call i32 @quo(i32 30000, i32 40000)
+  %r2 = call i32 @rem(i32 30000, i32 40000)
+  %q3 = call i32 @quo(i32 65535, i32 32768)
+  %r3 = call i32 @rem(i32 65535, i32 32768)
+  %q4 = call i32 @quo(i32 40000, i32 40000)
+  %r4 = call i32 @rem(i32 40000, i32 40000)
+  %d1 = sub i32 %r1, %r2
+  %d2 = add i32 %d1, %r3
+  %d3 = sub i32 %d2, %r4
+  %m1 = mul i32 %q1, 1000
+  %m2 = mul i32 %q2, 100
+  %m3 = mul i32 %q3, 10
+  %s1 = add i32 %d3, %m1
+  %s2 = add i32 %s1, %m2
+  %s3 = add i32 %s2, %m3
+  %s4 = add i32 %s3, %q4
+  ret i32 %s4
+}
@@ -0,0 +1,33 @@
+; A udiv and a urem of the same operands share one division, which leaves
+; the quotient in R1 and the remainder in R3. In @dm the remainder is kept in
+; R1, so the quotient has to be moved out of R1 before the remainder moves in.
+; RESULT: 1024
+; OPTIONS: -lc3-inline-budget=0
+
+define i32 @dm() {
+entry:
+  %q = udiv i32 1000, 7
+  %r = urem i32 1000, 7
+  %t = add i32 %r, 1
+  %u = shl i32 %t, %t
+  %v = add i32 %u, %q
+  ret i32 %v
+}
+
+define i32 @md() {
+entry:
+  %r = urem i32 1000, 7
+  %q = udiv i32 1000, 7
+  %t = and i32 %q, 3
+  %u = shl i32 %t, %t
+  %v = add i32 %u, %r
+  ret i32 %v
+}
+
+define i32 @main() {
+entry:
+  %x = call i32 @dm()
+  %y = call i32 @md()
+  %z = sub i32 %x, %y
+  ret i32 %z
+}